@@ -2,9 +2,12 @@
 #define AFFINE_HULL_HPP_
 
 #include <cassert>
+#include <cmath>
+#include <cstdint>
 
 #include <algorithm>
 #include <iterator>
+#include <limits>
 #include <ostream>
 #include <utility>
 #include <vector>
@@ -12,6 +15,9 @@
 #include <Eigen/Core>
 
 #include "dynamic_qr.hpp"
+#include "metrics.hpp"
+#include "predicates.hpp"
+#include "qr_cache.hpp"
 #include "utility.hpp"
 
 namespace FC {
@@ -31,19 +37,28 @@ private:
 public:
   typedef typename member_container::const_iterator const_iterator;
   
-  affine_hull(point_cloud_type const& pc)
-    : _dyn_qr(pc.dim()), _members(), _pc(pc) {
+  typedef qr_cache<number_type, size_type>      cache_type;
+
+  /**
+    @param cache if not null, factorizations of the affine hulls obtained by
+                 appending or dropping points are looked up in and stored to
+                 this cache. Note that a cache hit may change the order of
+                 the members.
+  */
+  affine_hull(point_cloud_type const& pc, cache_type * cache = nullptr)
+    : _dyn_qr(pc.dim()), _members(), _hash(0), _pc(pc), _cache(cache) {
     DLOG(INFO) << "**AH-CTOR " << this << std::endl;
   }
   
   affine_hull(affine_hull const& orig)
-    : _dyn_qr(orig._dyn_qr), _members(orig._members), _pc(orig._pc) {
+    : _dyn_qr(orig._dyn_qr), _members(orig._members), _hash(orig._hash),
+      _pc(orig._pc), _cache(orig._cache) {
     DLOG(INFO) << "**AH-COPY-CTOR " << this << std::endl;
   }
   
   affine_hull(affine_hull && tmp)
     : _dyn_qr(std::move(tmp._dyn_qr)), _members(std::move(tmp._members)),
-      _pc(tmp._pc) {
+      _hash(tmp._hash), _pc(tmp._pc), _cache(tmp._cache) {
     DLOG(INFO) << "**AH-MOVE-CTOR " << this << std::endl;
   }
 
@@ -58,10 +73,19 @@ public:
     DCHECK(_members.end() == std::find(_members.begin(), _members.end(), idx))
     << "added a point to the affine hull that was already contained: " << idx;
     DCHECK(size() <= _pc.dim()) << "added more than d+1 points to affine hull";
-    // it requires an idx that serves as the origin for adding a column
-    if (size() > 0)
-      _dyn_qr.append_column(_pc[idx] - _pc[_members.front()]);
-    _members.push_back(idx);
+    metrics::add(metric::hull_appends);
+    if (_cache && size() > 0) {
+      auto const contains = [this, idx] (size_type i) {
+        return i == idx || has_member(i);
+      };
+      if (adopt_cached(_hash + cache_type::hash_of(idx), size() + 1,
+                       contains))
+        return;
+      append_point_impl(idx);
+      _cache->insert(_hash, _members.begin(), _members.end(), _dyn_qr);
+    } else {
+      append_point_impl(idx);
+    }
   }
   
   /**
@@ -70,29 +94,20 @@ public:
   void drop_point(const_iterator it) {
     DLOG(INFO) << "dropping point " << *it;
     DCHECK(is_member(it));
-    if (_members.size() > 1) {
-      bool const del_orig = _members.begin() == it;
-      _dyn_qr.delete_column(del_orig ? 0 : // gets deleted because the point
-                                           // corresponding to this column
-                                           // will become the new origin
-                            std::distance(_members.cbegin(), it) - 1);
-      // if there's at least one column left after deleting a member
-      // we need to perform a rank-one update on it
-      if (del_orig && _members.size() > 2) {
-        _dyn_qr.rank_one_update(_pc[_members.front()] - _pc[_members[1]],
-                                eigen_vector::Ones(_dyn_qr.num_cols()));
-      }
+    metrics::add(metric::hull_drops);
+    if (_cache && size() > 2) {
+      size_type const dropped = *it;
+      auto const contains = [this, dropped] (size_type i) {
+        return i != dropped && has_member(i);
+      };
+      if (adopt_cached(_hash - cache_type::hash_of(dropped), size() - 1,
+                       contains))
+        return;
+      drop_point_impl(it);
+      _cache->insert(_hash, _members.begin(), _members.end(), _dyn_qr);
+    } else {
+      drop_point_impl(it);
     }
-    // instead of using std::vector::erase, we use this workaround to both
-    // preserve the order without the element being deleted and support
-    // standard library implementations before C++11
-    DCHECK(!_members.empty());
-    const std::size_t del_pos = std::distance(_members.cbegin(), it);
-    auto mutable_it = std::next(_members.begin(), del_pos);
-    std::rotate(mutable_it, std::next(mutable_it), _members.end());
-    _members.resize(_members.size() - 1);
-    DCHECK((_members.empty() && _dyn_qr.num_cols() == 0) ||
-           (_members.size() == _dyn_qr.num_cols() + 1));
   }
   
   /**
@@ -125,19 +140,141 @@ public:
     assert(lambda_const.size() == size());
     using lambda_t = Eigen::MatrixBase<Derived2>;
     auto & lambda = const_cast<lambda_t &>(lambda_const);
-    if (_members.size() > 1)
-      _dyn_qr.solve(x - _pc[*begin()], lambda.tail(lambda_const.size() - 1));
-    lambda[0] = 1 - lambda_const.tail(lambda_const.size() - 1).sum();
+    if (_members.size() > 1) {
+      auto lambda_tail = lambda.tail(lambda_const.size() - 1);
+      _dyn_qr.solve(x - _pc[*begin()], lambda_tail);
+      certify_signs(x, lambda_tail);
+    }
+    accurate_sum<number_type> lambda_0;
+    lambda_0.add(1);
+    for (size_type i = 1; i < size(); ++i)
+      lambda_0.add(-lambda[i]);
+    lambda[0] = lambda_0.value();
   }
 
 private:
+  void append_point_impl(size_type const idx) {
+    // it requires an idx that serves as the origin for adding a column
+    if (size() > 0)
+      _dyn_qr.append_column(_pc[idx] - _pc[_members.front()]);
+    _members.push_back(idx);
+    _hash += cache_type::hash_of(idx);
+  }
+
+  void drop_point_impl(const_iterator it) {
+    if (_members.size() > 1) {
+      bool const del_orig = _members.begin() == it;
+      _dyn_qr.delete_column(del_orig ? 0 : // gets deleted because the point
+                                           // corresponding to this column
+                                           // will become the new origin
+                            std::distance(_members.cbegin(), it) - 1);
+      // if there's at least one column left after deleting a member
+      // we need to perform a rank-one update on it
+      if (del_orig && _members.size() > 2) {
+        _dyn_qr.rank_one_update(_pc[_members.front()] - _pc[_members[1]],
+                                eigen_vector::Ones(_dyn_qr.num_cols()));
+      }
+    }
+    // instead of using std::vector::erase, we use this workaround to both
+    // preserve the order without the element being deleted and support
+    // standard library implementations before C++11
+    DCHECK(!_members.empty());
+    _hash -= cache_type::hash_of(*it);
+    const std::size_t del_pos = std::distance(_members.cbegin(), it);
+    auto mutable_it = std::next(_members.begin(), del_pos);
+    std::rotate(mutable_it, std::next(mutable_it), _members.end());
+    _members.resize(_members.size() - 1);
+    DCHECK((_members.empty() && _dyn_qr.num_cols() == 0) ||
+           (_members.size() == _dyn_qr.num_cols() + 1));
+  }
+  
+  /**
+    @brief replaces members and factorization by the cached ones for the
+           given index set, if available
+    @param hash, size, contains the index set, see qr_cache::find
+  */
+  template <class Contains>
+  bool adopt_cached(std::uint64_t hash, size_type size,
+                    Contains const& contains) {
+    auto const entry = _cache->find(hash, size, contains);
+    if (!entry)
+      return false;
+    _members = entry->members;
+    _hash = hash;
+    _dyn_qr = dynamic_qr<number_type>(entry->qr);
+    return true;
+  }
+
+  bool has_member(size_type idx) const {
+    return _members.end() != std::find(_members.begin(), _members.end(), idx);
+  }
+
+  /**
+    @brief The signs of the coefficients decide which hull members are
+           dropped, hence they are filtered: if some coefficient is not
+           larger than the error bound of the solve (see
+           dynamic_qr::solve_error), one step of iterative refinement with a
+           compensated residual is applied. Coefficients that are still
+           within the (now much smaller) bound of the correction are snapped
+           to 0, i.e. x is taken to lie on the face that drops their members.
+           This tie-breaker is not certified: the bounds hold for the
+           factorization, whose own error from the updates is not tracked,
+           and an exact sign would need an exact least-squares solve.
+  */
+  template <typename Derived1, typename Derived2>
+  void certify_signs(Eigen::MatrixBase<Derived1> const& x,
+                     Eigen::MatrixBase<Derived2> & lambda) const {
+    using std::abs;
+    size_type const k = _dyn_qr.num_cols();
+    size_type const d = _dyn_qr.num_rows();
+    auto const& p_0 = _pc[*begin()];
+    number_type const eps = std::numeric_limits<number_type>::epsilon();
+    // reused by the calls on this thread, to keep the common case free of
+    // allocations
+    thread_local std::vector<number_type> err_store;
+    err_store.resize(k);
+    Eigen::Map<eigen_vector> err(err_store.data(), k);
+    _dyn_qr.solve_error(x - p_0, eps * (x - p_0).cwiseAbs(), lambda, err);
+    if ((lambda.cwiseAbs() - err).minCoeff() > 0)
+      return;
+    // compensated residual r = x - p_0 - sum_i lambda_i * (p_i - p_0), and
+    // the bound of its rounding
+    eigen_vector residual(d);
+    eigen_vector residual_err(d);
+    number_type const gamma = error_factor<number_type>(2 * k + 2);
+    for (size_type j = 0; j < d; ++j) {
+      accurate_sum<number_type> r_j;
+      r_j.add(x[j]);
+      r_j.add(-p_0[j]);
+      number_type magnitude = abs(x[j]) + abs(p_0[j]);
+      for (size_type i = 0; i < k; ++i) {
+        r_j.add_product(lambda[i], p_0[j]);
+        r_j.add_product(-lambda[i], _pc[_members[i + 1]][j]);
+        magnitude += abs(lambda[i]) * (abs(p_0[j]) +
+                                       abs(_pc[_members[i + 1]][j]));
+      }
+      residual[j] = r_j.value();
+      residual_err[j] = eps * abs(residual[j]) + gamma * gamma * magnitude;
+    }
+    eigen_vector delta(k);
+    _dyn_qr.solve(residual, delta);
+    lambda += delta;
+    _dyn_qr.solve_error(residual, residual_err, delta, err);
+    for (size_type i = 0; i < k; ++i)
+      if (abs(lambda[i]) <= err[i])
+        lambda[i] = 0;
+  }
+
   bool is_member(const_iterator it) const {
     return (_members.begin() <= it) && (it < _members.end());
   }
 
   dynamic_qr<number_type> _dyn_qr;
   member_container _members;
+  // the sum of qr_cache::hash_of over the members
+  std::uint64_t _hash;
   point_cloud_type const& _pc;
+  cache_type * _cache;
 };
 
 template <class PointCloud>
@@ -0,0 +1,195 @@
+#ifndef APPROXIMATE_HPP_
+#define APPROXIMATE_HPP_
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+#include <Eigen/Core>
+#include <glog/logging.h>
+
+#include "compute.hpp"
+#include "flow_complex.hpp"
+#include "options.hpp"
+#include "point_cloud.hpp"
+#include "random.hpp"
+#include "update.hpp"
+
+namespace FC {
+
+/**
+  @brief the quality and the cost of an approximate_flow_complex
+*/
+struct approximation_report {
+  std::size_t sample_size = 0;
+  // every point is within this distance of the subsample. The distance
+  // functions of the subsample and of all points differ by at most it, and
+  // so do the critical values of corresponding critical points.
+  double covering_radius = 0;
+  // the critical points of the subsample, without the minima, and how many
+  // of them are critical points of all points, as their circumballs contain
+  // no excluded point
+  std::size_t coarse_critical_points = 0;
+  std::size_t exact_critical_points = 0;
+  // the critical points of at least this radius were refined
+  double refine_radius = 0;
+  // of the sampling and the flow complex of the subsample, and of the
+  // refinement
+  double coarse_seconds = 0;
+  double refine_seconds = 0;
+};
+
+/**
+  @brief Computes the flow complex of a subsample of the points, and refines
+         it where the excluded points interfere (see update_flow_complex):
+         the critical points whose circumballs contain excluded points are
+         dropped, and the ascend and descend tasks search their surroundings
+         anew. Unlike an update, no ascends start at the excluded points, so
+         critical points far from the dropped ones may be missed.
+  @param options see compute_options, of both stages
+  @param approximation see approximation_options
+  @param report if not null, receives the quality and cost
+  @param stats if not null, receives the statistics of the last stage
+  @return the approximate flow complex, in terms of the indices of all
+          points. Without refinement, the excluded points are not minima.
+*/
+template <typename size_type, bool Aligned = false, typename PointIterator,
+          typename dim_type>
+flow_complex<typename base_t<decltype((*PointIterator())[0])>::type,
+             size_type>
+approximate_flow_complex(PointIterator begin, PointIterator end, dim_type dim,
+                         compute_options const& options,
+                         approximation_options const& approximation,
+                         approximation_report * report = nullptr,
+                         compute_statistics * stats = nullptr) {
+  using number_type = typename base_t<decltype((*PointIterator())[0])>::type;
+  using fc_type = flow_complex<number_type, size_type>;
+  using cp_type = typename fc_type::cp_type;
+  using pc_type = point_cloud<number_type, size_type, Aligned>;
+  auto const seconds_since = [] (std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - t).count();
+  };
+  auto const start = std::chrono::steady_clock::now();
+
+  pc_type pc(begin, end, dim);
+  size_type const num_points = pc.size();
+  CHECK(num_points > 0) << "empty point cloud";
+  size_type const num_samples = std::max<size_type>(1, std::min<size_type>(
+      num_points, size_type(std::ceil(approximation.sample_fraction *
+                                      num_points))));
+  // 1) choose the subsample, it precedes the excluded points in order
+  std::uint64_t const seed = options.seed < 0 ? random_seed() : options.seed;
+  counter_rng rng(seed, 0);
+  std::vector<size_type> order(num_points);
+  std::iota(order.begin(), order.end(), 0);
+  if (approximation.farthest_point) {
+    // the next sample is the point farthest from the samples so far
+    std::vector<number_type> sq_dist(num_points,
+                                     std::numeric_limits<number_type>::max());
+    std::swap(order[0], order[uniform_index(rng, num_points)]);
+    for (size_type s = 0; s + 1 < num_samples; ++s) {
+      auto const& p = pc[order[s]];
+      size_type farthest = s + 1;
+      for (size_type k = s + 1; k < num_points; ++k) {
+        auto & d = sq_dist[order[k]];
+        d = std::min(d, (pc[order[k]] - p).squaredNorm());
+        if (d > sq_dist[order[farthest]])
+          farthest = k;
+      }
+      std::swap(order[s + 1], order[farthest]);
+    }
+  } else {
+    for (size_type s = 0; s < num_samples; ++s)
+      std::swap(order[s], order[s + uniform_index(rng, num_points - s)]);
+  }
+  std::vector<number_type const*> points(num_points);
+  for (size_type k = 0; k < num_points; ++k)
+    points[k] = pc[order[k]].data();
+  std::vector<bool> is_sample(num_points, false);
+  for (size_type s = 0; s < num_samples; ++s)
+    is_sample[order[s]] = true;
+
+  // 2) the flow complex of the subsample
+  fc_type fc = compute_flow_complex<size_type, Aligned>(
+      points.begin(), points.begin() + num_samples, dim, options, stats);
+  double const coarse_seconds = seconds_since(start);
+  // the largest distance of an excluded point to the subsample
+  number_type sq_covering_radius = 0;
+  {
+    pc_type sample_pc(points.begin(), points.begin() + num_samples, dim);
+    size_type nn_idx;
+    number_type nn_sq_dist;
+    Eigen::Matrix<number_type, Eigen::Dynamic, 1> q;
+    for (size_type k = num_samples; k < num_points; ++k) {
+      q = pc[order[k]];
+      sample_pc.k_nearest_neighors(q, 1, &nn_idx, &nn_sq_dist);
+      sq_covering_radius = std::max(sq_covering_radius, nn_sq_dist);
+    }
+  }
+  double const covering_radius = std::sqrt(double(sq_covering_radius));
+  if (report) {
+    // the critical points whose circumballs contain no excluded point
+    std::vector<size_type> idx_store(num_points);
+    std::vector<size_type> support;
+    report->coarse_critical_points = 0;
+    report->exact_critical_points = 0;
+    for (auto const& cp : fc) {
+      if (cp.is_max_at_inf() || 0 == cp.index())
+        continue;
+      ++report->coarse_critical_points;
+      support.clear();
+      for (auto it = cp.idx_begin(); it != cp.idx_end(); ++it)
+        support.push_back(order[*it]);
+      auto const center = circumcenter(pc, support.begin(), support.end());
+      auto const idx_end = pc.radius_search(center, cp.sq_dist(),
+                                            idx_store.begin());
+      if (idx_end == std::find_if(idx_store.begin(), idx_end,
+            [&] (size_type idx) {
+              return !is_sample[idx] &&
+                     (pc[idx] - center).squaredNorm() < cp.sq_dist();
+            }))
+        ++report->exact_critical_points;
+    }
+    report->sample_size = num_samples;
+    report->covering_radius = covering_radius;
+    report->coarse_seconds = coarse_seconds;
+  }
+  auto const refine_start = std::chrono::steady_clock::now();
+
+  // 3) refine the critical points that the excluded points interfere with
+  bool const refine = approximation.refine && num_samples < num_points;
+  if (refine) {
+    double const min_radius =
+        approximation.refine_radius_factor * covering_radius;
+    if (report)
+      report->refine_radius = min_radius;
+    compute_options refine_options = options;
+    refine_options.r_min = std::max(options.r_min, min_radius);
+    fc = update_flow_complex<size_type, Aligned>(
+        fc, points.begin(), points.end(), dim, std::vector<size_type>(),
+        refine_options, stats, min_radius);
+  }
+  auto result = relabel(fc, order, num_points);
+  // the excluded points that no refined critical point reached
+  bool const refine_all = refine && approximation.refine_radius_factor <= 0;
+  if (!refine_all) {
+    erase_if(result, [&] (cp_type const& cp) {
+      return 0 == cp.index() && !is_sample[*cp.idx_begin()] &&
+             cp.succ_begin() == cp.succ_end();
+    });
+  }
+  if (report)
+    report->refine_seconds = seconds_since(refine_start);
+  return result;
+}
+
+}  // namespace FC
+
+#endif  // APPROXIMATE_HPP_
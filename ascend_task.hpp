@@ -3,8 +3,8 @@
 
 #include <cassert>
 
-#include <random>
 #include <exception>
+#include <istream>
 #include <iterator>
 #include <ostream>
 #include <tuple>
@@ -18,7 +18,10 @@
 #include "critical_point.hpp"
 #include "descend_task.hpp"
 #include "flow_complex.hpp"
+#include "metrics.hpp"
 #include "nn_along_ray.hpp"
+#include "random.hpp"
+#include "scratch_arena.hpp"
 #include "update_ray.hpp"
 #include "vertex_filter.hpp"
 #include "utility.hpp"
@@ -40,15 +43,19 @@ public:
 
   /**
     @brief use this constructor, to spawn an ascend_task at a random position
+    @param rng the random stream that determines the position
+    @param cache optional cache of factorizations, shared by all affine hulls
+                 that derive from this task
   */
-  ascend_task(point_cloud_type const& pc)
-    : _ah(pc), _location(pc.dim()), _ray(pc.dim())
+  ascend_task(point_cloud_type const& pc, counter_rng & rng,
+              typename affine_hull<point_cloud_type>::cache_type * cache = nullptr)
+    : _ah(pc, cache), _location(pc.dim()), _ray(pc.dim())
     {
     DLOG(INFO) << "***AT-CTOR: " << this << std::endl;
     std::tuple<size_type, number_type, bool> nn;
     // reseed as long as the nearest neighbor is not unique
     do {
-      gen_convex_comb(pc, _location);
+      gen_convex_comb(pc, _location, rng);
       nn = pc.nearest_neighbor(_location);
     } while (std::get<2>(nn));
     // add the nearest neighbor
@@ -57,6 +64,32 @@ public:
     _ray = _location - pc[*_ah.begin()];
   }
   
+  /**
+    @brief use this constructor, to spawn an ascend_task at a given position,
+           e.g. within a region that has to be recomputed
+    @param rng the position is moved slightly towards random points, and
+               again as long as its nearest neighbor is not unique or it is a
+               point of the cloud
+  */
+  ascend_task(point_cloud_type const& pc, eigen_vector location,
+              counter_rng & rng,
+              typename affine_hull<point_cloud_type>::cache_type * cache = nullptr)
+    : _ah(pc, cache), _location(std::move(location)), _ray(pc.dim())
+    {
+    DLOG(INFO) << "***AT-CTOR: " << this << std::endl;
+    // the given position may be degenerate, e.g. circumcenters lie in the
+    // affine hulls of their supports, where the flow has no direction
+    eigen_vector target(pc.dim());
+    decltype(pc.nearest_neighbor(_location)) nn;
+    do {
+      gen_convex_comb(pc, target, rng);
+      _location += 1e-3 * (target - _location);
+      nn = pc.nearest_neighbor(_location);
+    } while (std::get<2>(nn) || 0 == std::get<1>(nn));
+    _ah.append_point(std::get<0>(nn));
+    _ray = _location - pc[*_ah.begin()];
+  }
+  
     /**
     @brief spawn an ascend task that upflows from a d-1 Delaunay facet
   */
@@ -69,6 +102,21 @@ public:
     _ray.swap(ray);
   }
   
+  /**
+    @brief restores an ascend task written by save(), e.g. from a checkpoint
+  */
+  ascend_task(point_cloud_type const& pc, std::istream & is,
+              typename affine_hull<point_cloud_type>::cache_type * cache = nullptr)
+    : _ah(pc, cache), _location(), _ray() {
+    std::vector<size_type> members;
+    load_range(is, members);
+    for (auto const idx : members)
+      _ah.append_point(idx);
+    load_range(is, _location);
+    load_range(is, _ray);
+    load_range(is, _dropped);
+  }
+
   ascend_task (ascend_task && tmp)
     : _ah(std::move(tmp._ah)), _location(), _ray(), _dropped(tmp._dropped) {
     DLOG(INFO) << "***AT-MOVE-CTOR: " << this << std::endl;
@@ -94,15 +142,34 @@ public:
   ascend_task (ascend_task const&) = delete;
   ascend_task & operator=(ascend_task const&) = delete;
   
+  eigen_vector const& location() const {
+    return _location;
+  }
+  
+  affine_hull<point_cloud_type> const& hull() const {
+    return _ah;
+  }
+
+  /**
+    @brief writes the state of the task to os, see save_range
+  */
+  void save(std::ostream & os) const {
+    save_range(os, _ah.begin(), _ah.end());
+    save_range(os, _location.data(), _location.data() + _location.size());
+    save_range(os, _ray.data(), _ray.data() + _ray.size());
+    save_range(os, _dropped.begin(), _dropped.end());
+  }
+  
   // TODO ascend task handler not needed anymore
   template <class DTHandler, class ATHandler, class CIHandler>
   void execute(ATHandler &, DTHandler & dth, fc_type & fc,
-               CIHandler & cih) {
+               CIHandler & cih, scratch_arena<point_cloud_type> & arena) {
+    metrics::add(metric::ascend_tasks);
     auto const& pc = _ah.pc();
-    std::vector<size_type> nnvec(pc.dim() + 1);
-    std::vector<size_type> idx_store(pc.size());
-    eigen_vector driver(pc.dim());
-    eigen_vector lambda(pc.dim() + 1);
+    auto & nnvec = arena.nnvec;
+    auto & idx_store = arena.idx_store;
+    auto & driver = arena.driver;
+    auto & lambda = arena.lambda;
     // there's only 2 cases of ascend tasks: completely new, and those starting
     // with d points on the boundary. The first case has not dropped yet, the
     // 2nd case has always dropped before
@@ -118,7 +185,8 @@ public:
       };
       DCHECK(ball_is_empty(pc, _location, _ah, ignoreFn));
       vertex_filter<point_cloud_t, typename std::vector<size_type>::iterator>
-      vf(pc, _location, _ray, pc[*_ah.begin()], ignoreFn, idx_store.begin());
+      vf(pc, _location, _ray, pc[*_ah.begin()], ignoreFn, idx_store.begin(),
+         &arena.probe);
       DLOG(INFO) << _ah << std::endl
                << "LOCATION = " << _location.transpose() << std::endl
                << "DRIVER = " << driver.transpose() << std::endl
@@ -126,11 +194,19 @@ public:
       auto const max_nn = pc.dim() + 1 - _ah.size();
       nn = nearest_neighbor_along_ray(_location, _ray, pc[*_ah.begin()],
                                       vf, nnvec.begin(),
-                                      std::next(nnvec.begin(), max_nn));
+                                      std::next(nnvec.begin(), max_nn),
+                                      arena.nn);
       using ci_type = circumsphere_ident<size_type>;
-      if (nn.first == nnvec.begin()) {  // no nn found -> proxy at inf
+      // a stopper beyond the radius cutoff counts as none
+      bool const cut_off = nn.first != nnvec.begin() &&
+        (_location + nn.second * _ray - pc[*_ah.begin()]).squaredNorm() >
+        fc.sq_radius_cutoff();
+      if (cut_off && 1 == _ah.size())
+        break;  // an initial ascend - there is nothing to descend to
+      if (nn.first == nnvec.begin() || cut_off) {  // no nn found -> proxy at inf
         DLOG(INFO) << "NO STOPPER FOUND\n";
-        auto * inf_ptr = fc.max_at_inf();
+        // a cut off flow is told apart from one that reaches infinity
+        auto * inf_ptr = cut_off ? fc.max_at_cutoff() : fc.max_at_inf();
         if (!_dropped.empty()) {  // we dropped before flowing to infinity
           DLOG(INFO) << "DROPPED BEFORE FLOW TO INF\n";
           auto & pos_offsets = nnvec;  // reuse
@@ -161,7 +237,7 @@ public:
             if (cih(ci_type(_ah.begin(), _ah.end())))
               dth(dt(std::move(_ah), std::move(_location), inf_ptr));
           } else {
-            cp->add_successor(inf_ptr);
+            fc.add_incidence(cp, inf_ptr);
           }
         }
         break;  // EXIT 1
@@ -176,7 +252,7 @@ public:
         }
         // check for finite max
         if (_ah.size() == pc.dim() + 1) {
-          if (simplex_case_upflow(lambda, driver,
+          if (simplex_case_upflow(lambda, driver, arena.tmp_ray,
                               idx_store.begin(), idx_store.end(),
                               fc, dth))
             break;  // EXIT 2 --> finite maximum
@@ -199,21 +275,14 @@ private:
            points
     @param dim the the size of the point arrays
     @param target a pointer to at least dim elements where the result is placed
-           
+    @param rng the random stream to draw the points and coefficients from
   */
-  void gen_convex_comb(point_cloud_type const& pc, eigen_vector & target) {
-    // use a number type which is compatible with <random> within the STL
+  void gen_convex_comb(point_cloud_type const& pc, eigen_vector & target,
+                       counter_rng & rng) {
     using Float = long double;
-    std::random_device rd;
-    int seed = rd();
-    DLOG(INFO) << "seed = " << seed << std::endl;
-    std::mt19937 gen(seed);
-    // generates numbers in [0, pc.size() - 1]
-    std::uniform_int_distribution<size_type> rand_idx(0, pc.size() - 1);
-    std::uniform_real_distribution<Float> rand_real(0.5, 1.0);
-    std::vector<size_type> sampled_indices;
-    sampled_indices.reserve(pc.dim() + 1);
-    auto already_sampled = [&sampled_indices] (size_type idx) {
+    thread_local std::vector<size_type> sampled_indices;
+    sampled_indices.clear();
+    auto already_sampled = [] (size_type idx) {
       return sampled_indices.end() != std::find(sampled_indices.begin(),
                                                 sampled_indices.end(), idx);
     };
@@ -222,11 +291,11 @@ private:
     for (size_type i = 0; i < (pc.dim() + size_type(1)); ++i) {
       size_type idx;
       do {
-        idx = rand_idx(gen);
+        idx = uniform_index(rng, pc.size());
         assert(0 <= idx);
         assert(idx < pc.size());
       } while(already_sampled(idx));
-      Float tmp = rand_real(gen);
+      Float tmp = uniform_real<Float>(rng, 0.5, 1.0);
       sum += tmp;
       sampled_indices.push_back(idx);
       target += tmp * pc[idx];
@@ -242,6 +311,7 @@ private:
   template <class IdxIterator, class DTHandler>
   bool simplex_case_upflow(eigen_vector & lambda,
                            eigen_vector & driver,
+                           eigen_vector & tmp_ray,
                            IdxIterator begin, IdxIterator end,
                            fc_type & fc, DTHandler & dth) {
     auto & ah = _ah;
@@ -288,15 +358,15 @@ private:
         const size_type dropped_idx = *it_to_neg_idx;
         _dropped.push_back(dropped_idx);
         new_ah.drop_point(it_to_neg_idx);
-        eigen_vector tmp_ray(pc.dim());
         update_ray<RAY_DIR::FROM_DRIVER>(new_ah, x, lambda, driver, tmp_ray);
         ray += tmp_ray;
       }
       CHECK(_dropped.size() < std::numeric_limits<number_type>::max());
       ray /= static_cast<number_type>(_dropped.size());
-      // now perform the actual dropping on the used affine hull
-      for (auto it = begin; it != neg_end; ++it)
-        _ah.drop_point(_ah.begin() + *it);
+      // now perform the actual dropping on the used affine hull - by index,
+      // since a cached factorization may come with a different member order
+      for (const auto idx : _dropped)
+        _ah.drop_point(std::find(_ah.begin(), _ah.end(), idx));
       return false;
     }
   }
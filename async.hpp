@@ -0,0 +1,118 @@
+#ifndef ASYNC_HPP_
+#define ASYNC_HPP_
+
+#include <cstddef>
+
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <thread>
+#include <utility>
+
+#include <tbb/concurrent_queue.h>
+
+#include "compute.hpp"
+#include "flow_complex.hpp"
+#include "options.hpp"
+
+namespace FC {
+
+/**
+  @brief The callbacks of compute_flow_complex_async. They get copies of
+         the critical points without successors, and run one at a time on a
+         thread of their own, in the order the changes were made. As the
+         workers report concurrently, an incidence may arrive before its
+         critical point. Empty callbacks are skipped.
+*/
+template <typename CP>
+struct stream_callbacks {
+  std::function<void(CP const&)> on_critical_point;
+  // (cp, succ) where succ is a new successor of cp
+  std::function<void(CP const&, CP const&)> on_incidence;
+  // the number of changes that may wait for the callbacks, before the
+  // workers that report more wait for them
+  std::size_t queue_capacity = 4096;
+};
+
+/**
+  @brief Starts compute_flow_complex on a thread of its own and streams its
+         critical points and incidences to the callbacks as they are found.
+         The points have to stay valid until the computation is done. If a
+         callback throws, the computation is cancelled, but not the token of
+         options (see compute_options::cancel), and the future rethrows the
+         exception.
+  @return the flow complex, once the computation is done and all changes
+          were passed to the callbacks
+*/
+template <typename size_type, bool Aligned = false, typename PointIterator,
+          typename dim_type>
+std::future<flow_complex<typename base_t<decltype((*PointIterator())[0])>::type,
+                         size_type>>
+compute_flow_complex_async(
+    PointIterator begin, PointIterator end, dim_type dim,
+    compute_options const& options,
+    stream_callbacks<critical_point<
+        typename base_t<decltype((*PointIterator())[0])>::type,
+        size_type>> callbacks,
+    compute_statistics * stats = nullptr) {
+  using number_type = typename base_t<decltype((*PointIterator())[0])>::type;
+  using fc_type = flow_complex<number_type, size_type>;
+  using cp_type = typename fc_type::cp_type;
+  return std::async(std::launch::async, [=] {
+    // a change is a new critical point, or a new successor of it. An empty
+    // change ends the stream.
+    using change = std::pair<std::unique_ptr<cp_type>, std::unique_ptr<cp_type>>;
+    auto const copy = [] (cp_type const& cp) {
+      return std::unique_ptr<cp_type>(
+          cp.idx_begin() == cp.idx_end()
+              ? new cp_type(cp.index(), cp.is_cut_off())
+              : new cp_type(cp.idx_begin(), cp.idx_end(), cp.sq_dist()));
+    };
+    compute_options local_options = options;
+    local_options.cancel = options.cancel.linked();
+    tbb::concurrent_bounded_queue<change> queue;
+    queue.set_capacity(callbacks.queue_capacity);
+    std::exception_ptr error;
+    std::thread consumer([&] {
+      change c;
+      for (queue.pop(c); c.first; queue.pop(c)) {
+        if (error)
+          continue;  // drain, so that the workers do not wait
+        try {
+          if (!c.second && callbacks.on_critical_point)
+            callbacks.on_critical_point(*c.first);
+          else if (c.second && callbacks.on_incidence)
+            callbacks.on_incidence(*c.first, *c.second);
+        } catch (...) {
+          error = std::current_exception();
+          local_options.cancel.cancel();
+        }
+      }
+    });
+    // ends the stream also if the computation throws
+    struct stream_end {
+      tbb::concurrent_bounded_queue<change> & queue;
+      std::thread & consumer;
+      ~stream_end() {
+        queue.push(change());
+        consumer.join();
+      }
+    };
+    auto fc = [&] {
+      stream_end const guard{queue, consumer};
+      return compute_flow_complex<size_type, Aligned>(
+          begin, end, dim, local_options, stats,
+          [&] (cp_type const& cp, cp_type const* succ) {
+            queue.push(change(copy(cp), succ ? copy(*succ) : nullptr));
+          });
+    }();
+    if (error)
+      std::rethrow_exception(error);
+    return fc;
+  });
+}
+
+}  // namespace FC
+
+#endif  // ASYNC_HPP_
@@ -0,0 +1,90 @@
+#ifndef BATCH_HPP_
+#define BATCH_HPP_
+
+#include <cstddef>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <iterator>
+#include <mutex>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_group.h>
+
+#include "compute.hpp"
+#include "options.hpp"
+
+namespace FC {
+
+/**
+  @brief Computes the flow complexes of many point clouds on one arena of
+         options.num_threads workers. Every cloud is computed by a single
+         worker with the other options, while the workers take the next
+         cloud as soon as they are done, the largest clouds first. Hence
+         small clouds keep all workers busy, unlike a parallel computation
+         of one cloud after the other.
+  @param begin, end the point clouds, which provide cbegin(), cend() and
+                    dim(), see point_store
+  @param sink sink(i, fc) receives the flow complex of the i-th cloud. It is
+              called by the worker that computed it, hence by several at
+              once.
+  @return the positions of the clouds whose computation threw, with the
+          exceptions. The other clouds are computed regardless.
+*/
+template <typename size_type, bool Aligned = false, class CloudIterator,
+          class Sink>
+std::vector<std::pair<std::size_t, std::exception_ptr>>
+compute_flow_complex_batch(CloudIterator begin, CloudIterator end,
+                           compute_options const& options, Sink const& sink) {
+  CHECK(options.checkpoint.empty()) << "a batch cannot be checkpointed";
+  std::size_t const num_clouds = std::distance(begin, end);
+  std::vector<std::size_t> order(num_clouds);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [begin] (std::size_t i, std::size_t j) {
+    return std::distance(begin[i].cbegin(), begin[i].cend()) >
+           std::distance(begin[j].cbegin(), begin[j].cend());
+  });
+  compute_options cloud_options = options;
+  cloud_options.num_threads = 1;
+  int num_threads = options.num_threads;
+  if (num_threads < 0) num_threads = tbb::this_task_arena::max_concurrency();
+  std::atomic<std::size_t> next(0);
+  std::mutex failed_mutex;
+  std::vector<std::pair<std::size_t, std::exception_ptr>> failed;
+  tbb::task_arena arena(num_threads);
+  arena.execute([&] {
+    tbb::task_group workers;
+    for (int w = 0; w < num_threads; ++w)
+      workers.run([&] {
+        for (std::size_t k; (k = next.fetch_add(1)) < num_clouds;) {
+          std::size_t const i = order[k];
+          auto const& cloud = begin[i];
+          try {
+            sink(i, compute_flow_complex<size_type, Aligned>(
+                        cloud.cbegin(), cloud.cend(), cloud.dim(),
+                        cloud_options));
+          } catch (...) {
+            std::lock_guard<std::mutex> lock(failed_mutex);
+            failed.emplace_back(i, std::current_exception());
+          }
+        }
+      });
+    workers.wait();
+  });
+  std::sort(failed.begin(), failed.end(),
+            [] (std::pair<std::size_t, std::exception_ptr> const& a,
+                std::pair<std::size_t, std::exception_ptr> const& b) {
+    return a.first < b.first;
+  });
+  return failed;
+}
+
+}  // namespace FC
+
+#endif  // BATCH_HPP_
@@ -0,0 +1,49 @@
+#ifndef CANCELLATION_HPP_
+#define CANCELLATION_HPP_
+
+#include <atomic>
+#include <memory>
+
+namespace FC {
+
+/**
+  @brief A flag by which a computation is cancelled from another thread, see
+         compute_options::cancel. The copies of a token share the flag, hence
+         a copy kept by the caller cancels the computation that got the
+         options. cancel() is lock-free, so it may also be called from a
+         signal handler. A linked token is cancelled along with the one it
+         is linked to, but not the other way round.
+*/
+class cancellation_token {
+public:
+  cancellation_token()
+    : _flag(std::make_shared<std::atomic<bool>>(false)), _parent() {
+  }
+
+  void cancel() const {
+    _flag->store(true, std::memory_order_relaxed);
+  }
+
+  bool cancelled() const {
+    return _flag->load(std::memory_order_relaxed) ||
+           (_parent && _parent->load(std::memory_order_relaxed));
+  }
+
+  /**
+    @return a new token that is also cancelled by this one
+  */
+  cancellation_token linked() const {
+    cancellation_token t;
+    t._parent = _flag;
+    return t;
+  }
+
+private:
+  std::shared_ptr<std::atomic<bool>> _flag;
+  // tokens are linked one level deep, which suffices for compute_options
+  std::shared_ptr<std::atomic<bool>> _parent;
+};
+
+}  // namespace FC
+
+#endif  // CANCELLATION_HPP_
@@ -0,0 +1,304 @@
+#ifndef CHECKPOINT_HPP_
+#define CHECKPOINT_HPP_
+
+#include <cmath>
+#include <cstdio>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <istream>
+#include <iterator>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+#include <tbb/enumerable_thread_specific.h>
+
+#include "affine_hull.hpp"
+#include "critical_point.hpp"
+#include "fingerprint_set.hpp"
+#include "flow_complex.hpp"
+#include "utility.hpp"
+
+namespace FC {
+
+/**
+  @brief writes the record of the incidence of cp with succ. The successor is
+         written by its indices, which are none for the maximum at infinity
+         and for the cut off flows, and whether it is the latter.
+*/
+template <typename nt, typename st>
+void save_incidence(std::ostream & os, critical_point<nt, st> const& cp,
+                    critical_point<nt, st> const& succ) {
+  os << 's';
+  save_range(os, cp.idx_begin(), cp.idx_end());
+  os << ' ' << succ.is_cut_off();
+  save_range(os, succ.idx_begin(), succ.idx_end());
+  os << '\n';
+}
+
+/**
+  @brief writes the records of the tasks that wait for execution, see
+         Task::save
+*/
+template <class Task>
+void save_tasks(std::ostream & os, std::vector<Task *> const& waiting) {
+  using number_type = typename Task::number_type;
+  os << std::setprecision(std::numeric_limits<number_type>::max_digits10);
+  for (auto const* t : waiting) {
+    os << "t ";
+    t->save(os);
+    os << '\n';
+  }
+}
+
+/**
+  @brief Writes the state of a computation of the flow complex at a moment
+         where no task runs: the critical points with their successors, the
+         sets that suppress duplicate tasks and the tasks that wait for
+         execution. It is the first block of a checkpoint, the changes since
+         are appended as further blocks (see checkpoint_journal). The
+         computation resumes from it by load_checkpoint.
+*/
+template <class Task>
+void save_checkpoint(std::ostream & os, typename Task::fc_type const& fc,
+                     fingerprint_set<typename Task::size_type> const& acis,
+                     fingerprint_set<typename Task::size_type> const& dcis,
+                     std::vector<Task *> const& waiting) {
+  using number_type = typename Task::number_type;
+  os << std::setprecision(std::numeric_limits<number_type>::max_digits10);
+  auto const cutoff = fc.sq_radius_cutoff();
+  os << "flow-complex-checkpoint 3\n"
+     << fc.max_at_inf()->index() << ' ' << fc.num_minima() << ' '
+     << (std::isinf(cutoff) ? number_type(-1) : cutoff) << '\n';
+  for (auto const& cp : fc) {
+    if (cp.is_max_at_inf())
+      continue;
+    os << 'p';
+    save_range(os, cp.idx_begin(), cp.idx_end());
+    os << ' ' << cp.sq_dist() << '\n';
+  }
+  for (auto const& cp : fc)
+    for (auto it = cp.succ_begin(); it != cp.succ_end(); ++it)
+      save_incidence(os, cp, **it);
+  os << "A\n";
+  acis.save(os);
+  os << "D\n";
+  dcis.save(os);
+  save_tasks(os, waiting);
+  os << "end\n";
+}
+
+/**
+  @brief Records the changes of a computation on the threads that make them:
+         the critical points and incidences as the observer of the flow
+         complex (see flow_complex::set_observer), and the new entries of
+         the sets that suppress duplicate tasks. A checkpoint takes them by
+         cut() while the workers hold, and appends them to the file by
+         save_delta() while they continue, instead of writing the whole
+         state again.
+*/
+template <class Task>
+class checkpoint_journal {
+public:
+  typedef typename Task::fc_type              fc_type;
+  typedef typename fc_type::cp_type           cp_type;
+  typedef typename Task::size_type            size_type;
+
+  void record(cp_type const& cp, cp_type const* succ) {
+    _local.local().events.emplace_back(&cp, succ);
+  }
+
+  /**
+    @param descend whether the index set went to the set of the descends,
+                   else of the ascends
+  */
+  template <class Iterator>
+  void record(bool descend, Iterator begin, Iterator end) {
+    auto & keys = descend ? _local.local().descend_keys
+                          : _local.local().ascend_keys;
+    keys.push_back(size_type(std::distance(begin, end)));
+    keys.insert(keys.end(), begin, end);
+  }
+
+  /**
+    @brief takes the changes recorded so far. Must not run concurrently with
+           record().
+  */
+  void cut() {
+    for (auto & changes : _local) {
+      _cut.emplace_back();
+      std::swap(_cut.back(), changes);
+    }
+  }
+
+  /**
+    @brief appends the changes taken by cut(), followed by the tasks that
+           waited for execution at that time (see save_tasks), as a block of
+           the checkpoint. May run concurrently with record().
+  */
+  void save_delta(std::ostream & os, std::string const& waiting) {
+    using number_type = typename Task::number_type;
+    os << std::setprecision(std::numeric_limits<number_type>::max_digits10);
+    os << "delta\n";
+    for (auto const& changes : _cut) {
+      for (auto const& e : changes.events) {
+        if (e.second) {
+          save_incidence(os, *e.first, *e.second);
+        } else {
+          os << 'p';
+          save_range(os, e.first->idx_begin(), e.first->idx_end());
+          os << ' ' << e.first->sq_dist() << '\n';
+        }
+      }
+      save_keys(os, 'a', changes.ascend_keys);
+      save_keys(os, 'd', changes.descend_keys);
+    }
+    _cut.clear();
+    os << waiting << "end\n";
+  }
+
+private:
+  struct changes_type {
+    // (cp, nullptr) for an insertion, (cp, succ) for an incidence
+    std::vector<std::pair<cp_type const*, cp_type const*>> events;
+    // the index sets, each preceded by its size
+    std::vector<size_type>                                 ascend_keys;
+    std::vector<size_type>                                 descend_keys;
+  };
+
+  static void save_keys(std::ostream & os, char tag,
+                        std::vector<size_type> const& keys) {
+    for (auto it = keys.begin(); it != keys.end(); it += *it + 1) {
+      os << tag;
+      save_range(os, std::next(it), std::next(it, *it + 1));
+      os << '\n';
+    }
+  }
+
+  tbb::enumerable_thread_specific<changes_type> _local;
+  std::vector<changes_type>                     _cut;
+};
+
+/**
+  @brief restores the state written by save_checkpoint and the blocks that
+         checkpoint_journal::save_delta appended into fc, which only holds
+         its minima yet, and the sets, which are empty. A block that was not
+         written completely, e.g. by a crash, is ignored.
+  @return the tasks that waited for execution at the last complete block,
+          allocated from pool
+*/
+template <class Task, class PointCloud, class Pool>
+std::vector<Task *> load_checkpoint(
+    std::istream & is, PointCloud const& pc, typename Task::fc_type & fc,
+    fingerprint_set<typename Task::size_type> & acis,
+    fingerprint_set<typename Task::size_type> & dcis, Pool & pool,
+    typename affine_hull<PointCloud>::cache_type * cache) {
+  using number_type = typename Task::number_type;
+  using size_type = typename Task::size_type;
+  using cp_type = typename Task::fc_type::cp_type;
+  std::string magic;
+  int version = 0;
+  is >> magic >> version;
+  if ("flow-complex-checkpoint" != magic)
+    throw std::runtime_error("not a checkpoint of a flow complex");
+  if (3 != version)
+    throw std::runtime_error("unsupported version of the checkpoint");
+  size_type dim = 0, num_points = 0;
+  number_type cutoff = 0;
+  is >> dim >> num_points >> cutoff;
+  if (dim != fc.max_at_inf()->index() || num_points != fc.num_minima())
+    throw std::runtime_error("the checkpoint is of another point cloud");
+  if (cutoff >= 0)
+    fc.set_sq_radius_cutoff(cutoff);
+  // the records of a block are applied once it is complete, as its
+  // incidences may precede the critical points they refer to
+  std::vector<std::pair<std::vector<size_type>, number_type>> cps;
+  struct incidence {
+    std::vector<size_type> cp;
+    bool                   cut_off;
+    std::vector<size_type> succ;
+  };
+  std::vector<incidence> incidences;
+  std::vector<std::vector<size_type>> keys[2];
+  std::string block_tasks, tasks;
+  std::size_t num_blocks = 0;
+  std::string tag, line;
+  while (is >> tag) {
+    if ("p" == tag) {
+      cps.emplace_back();
+      load_range(is, cps.back().first);
+      is >> cps.back().second;
+    } else if ("s" == tag) {
+      incidences.emplace_back();
+      load_range(is, incidences.back().cp);
+      is >> incidences.back().cut_off;
+      load_range(is, incidences.back().succ);
+    } else if ("a" == tag || "d" == tag) {
+      keys["d" == tag].emplace_back();
+      load_range(is, keys["d" == tag].back());
+    } else if ("A" == tag || "D" == tag) {
+      ("D" == tag ? dcis : acis).load(is);
+    } else if ("t" == tag) {
+      std::getline(is, line);
+      block_tasks += line + '\n';
+    } else if ("end" == tag) {
+      for (auto const& el : cps)
+        fc.insert(cp_type(el.first.begin(), el.first.end(), el.second));
+      for (auto const& inc : incidences) {
+        auto * cp = fc.find(cp_type(inc.cp.begin(), inc.cp.end(), 0));
+        auto * succ = inc.cut_off ? fc.max_at_cutoff()
+            : inc.succ.empty() ? fc.max_at_inf()
+                               : fc.find(cp_type(inc.succ.begin(),
+                                                 inc.succ.end(), 0));
+        CHECK(cp && succ) << "the checkpoint lacks a critical point";
+        fc.add_incidence(cp, succ);
+      }
+      for (int descend = 0; descend < 2; ++descend)
+        for (auto const& key : keys[descend])
+          (descend ? dcis : acis).insert(key.begin(), key.end());
+      tasks.swap(block_tasks);
+      block_tasks.clear();
+      cps.clear();
+      incidences.clear();
+      keys[0].clear();
+      keys[1].clear();
+      ++num_blocks;
+    } else if ("delta" != tag) {
+      break;
+    }
+  }
+  if (0 == num_blocks)
+    throw std::runtime_error("the checkpoint is truncated");
+  std::istringstream task_stream(tasks);
+  std::vector<Task *> result;
+  while (auto * t = Task::load(task_stream, pc, fc, pool, cache))
+    result.push_back(t);
+  return result;
+}
+
+/**
+  @brief replaces the file at path by the contents that write(os) writes,
+         such that a crash leaves either the old or the new contents
+*/
+template <class Write>
+void replace_file(std::string const& path, Write const& write) {
+  std::string const tmp_path = path + ".tmp";
+  {
+    std::ofstream f(tmp_path, std::ios::binary);
+    if (!f || (write(f), !f.flush()))
+      throw std::runtime_error("could not write to file " + tmp_path);
+  }
+  if (0 != std::rename(tmp_path.c_str(), path.c_str()))
+    throw std::runtime_error("could not replace the file " + path);
+}
+
+}  // namespace FC
+
+#endif  // CHECKPOINT_HPP_
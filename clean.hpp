@@ -1,61 +1,143 @@
 #ifndef CLEAN_HPP_
 #define CLEAN_HPP_
 
+#include <cstddef>
+
 #include <algorithm>
-#include <functional>
-#include <map>
+#include <limits>
+#include <numeric>
 #include <vector>
-#include <utility>
+
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_for.h>
 
 #include "critical_point.hpp"
 #include "flow_complex.hpp"
 
 namespace FC {
 
-template <typename nt, typename st>
-bool exists_path(critical_point<nt, st> const* from,
-                 critical_point<nt, st> const* to) {
-  using namespace std::placeholders;
-  auto exists_path_to = std::bind(&exists_path<nt, st>, _1, to);
-  return to->index() > from->index() &&
-         ((from->succ_end() !=
-          std::find(from->succ_begin(), from->succ_end(), to)) ||
-          (from->succ_end() !=
-          std::find_if(from->succ_begin(), from->succ_end(), exists_path_to))
-         );
-}
-
 /**
 @brief Let x, y be predecessors of a critical point z. Because of the way we
        explore the Hasse Diagram, it may happen that x is also the predecessor
        of y, or the predecessor of one of y's predecessors. In that case, we
-       remove the incidence from x to z. This function does
+       remove the incidence from x to z. More precisely, a successor z of a
+       critical point is redundant if another successor reaches it by a path
+       of critical points of lower index than z. The critical points from
+       which z is reached this way are searched once for every z along the
+       predecessors, then the successors of all critical points are checked
+       in parallel.
 */
 template <typename nt, typename st>
 flow_complex<nt, st> clean_incidences(flow_complex<nt, st> fc) {
   using fc_type = flow_complex<nt, st>;
   using cp_type = typename fc_type::cp_type;
+  std::size_t constexpr none = std::numeric_limits<std::size_t>::max();
+  using range = tbb::blocked_range<std::size_t>;
 
-  // contains a pair for every cp, that has redundant successors
-  std::map<cp_type *, std::vector<cp_type const*>> to_delete;
-  // detect redundant successors
-  for (auto & cp : fc) {  // TODO parallelize this loop
-    std::vector<cp_type const*> redundant_succs;
-    for (auto from_it = cp.succ_begin(); from_it != cp.succ_end(); ++from_it)
-      for (auto to_it = cp.succ_begin(); to_it != cp.succ_end(); ++to_it)
-        if (exists_path(*from_it, *to_it))
-          redundant_succs.push_back(*to_it);
-    if (!redundant_succs.empty())
-      to_delete.emplace(&cp, std::move(redundant_succs));
+  // the critical points by position, ordered by address, with their
+  // successors and predecessors as ranges of positions in succs and preds
+  std::vector<cp_type *> cps;
+  cps.reserve(fc.size() + 1);
+  for (auto & cp : fc)
+    cps.push_back(&cp);
+  // the cut off flows end at a successor outside of the critical points
+  cps.push_back(fc.max_at_cutoff());
+  std::sort(cps.begin(), cps.end());
+  auto const position = [&cps] (cp_type const* cp) -> std::size_t {
+    return std::lower_bound(cps.begin(), cps.end(), cp) - cps.begin();
+  };
+  std::size_t const num_cps = cps.size();
+  std::vector<st> index(num_cps);
+  std::vector<std::size_t> succ_offset(num_cps + 1, 0);
+  for (std::size_t i = 0; i < num_cps; ++i)
+    succ_offset[i + 1] = succ_offset[i] +
+                         (cps[i]->succ_end() - cps[i]->succ_begin());
+  std::vector<std::size_t> succs(succ_offset[num_cps]);
+  tbb::parallel_for(range(0, num_cps), [&] (range const& r) {
+    for (std::size_t i = r.begin(); i != r.end(); ++i) {
+      index[i] = cps[i]->index();
+      std::transform(cps[i]->succ_begin(), cps[i]->succ_end(),
+                     succs.begin() + succ_offset[i],
+                     [&] (cp_type const* succ) { return position(succ); });
+    }
+  });
+  std::vector<std::size_t> pred_offset(num_cps + 1, 0);
+  for (std::size_t s : succs)
+    ++pred_offset[s + 1];
+  std::partial_sum(pred_offset.begin(), pred_offset.end(),
+                   pred_offset.begin());
+  std::vector<std::size_t> preds(succs.size());
+  {
+    std::vector<std::size_t> fill(pred_offset.begin(), pred_offset.end() - 1);
+    for (std::size_t i = 0; i < num_cps; ++i)
+      for (std::size_t k = succ_offset[i]; k != succ_offset[i + 1]; ++k)
+        preds[fill[succs[k]]++] = i;
+  }
+  // the successors that may be reached from another successor, which is of
+  // lower index, get a slot in reached_from. The critical points whose
+  // successors are all of the same index have no redundant ones.
+  std::vector<std::size_t> slot(num_cps, none);
+  std::vector<std::size_t> targets;
+  for (std::size_t i = 0; i < num_cps; ++i) {
+    auto const b = succs.begin() + succ_offset[i];
+    auto const e = succs.begin() + succ_offset[i + 1];
+    if (b == e)
+      continue;
+    st const min_index = index[*std::min_element(b, e,
+        [&] (std::size_t x, std::size_t y) { return index[x] < index[y]; })];
+    for (auto it = b; it != e; ++it)
+      if (index[*it] > min_index && none == slot[*it]) {
+        slot[*it] = targets.size();
+        targets.push_back(*it);
+      }
   }
-  // clean the flow complex from redundant incidences
-  for (auto const& p : to_delete)
-    for (auto succ : p.second)
-      p.first->erase(succ);
+  // the critical points from which a target is reached, sorted
+  std::vector<std::vector<std::size_t>> reached_from(targets.size());
+  tbb::enumerable_thread_specific<std::vector<std::size_t>> visited_store(
+      num_cps, none);
+  tbb::parallel_for(range(0, targets.size()), [&] (range const& r) {
+    auto & visited = visited_store.local();
+    std::vector<std::size_t> stack;
+    for (std::size_t t = r.begin(); t != r.end(); ++t) {
+      st const max_index = index[targets[t]];
+      auto & reached = reached_from[t];
+      stack.push_back(targets[t]);
+      while (!stack.empty()) {
+        std::size_t const k = stack.back();
+        stack.pop_back();
+        for (std::size_t j = pred_offset[k]; j != pred_offset[k + 1]; ++j) {
+          std::size_t const p = preds[j];
+          if (visited[p] != t && index[p] < max_index) {
+            visited[p] = t;
+            reached.push_back(p);
+            stack.push_back(p);
+          }
+        }
+      }
+      std::sort(reached.begin(), reached.end());
+    }
+  });
+  // detect and erase redundant successors, in the order of the pairs
+  tbb::parallel_for(range(0, num_cps), [&] (range const& r) {
+    std::vector<std::size_t> redundant;
+    for (std::size_t i = r.begin(); i != r.end(); ++i) {
+      auto const b = succs.begin() + succ_offset[i];
+      auto const e = succs.begin() + succ_offset[i + 1];
+      redundant.clear();
+      for (auto from = b; from != e; ++from)
+        for (auto to = b; to != e; ++to)
+          if (index[*to] > index[*from] &&
+              std::binary_search(reached_from[slot[*to]].begin(),
+                                 reached_from[slot[*to]].end(), *from))
+            redundant.push_back(*to);
+      for (std::size_t succ : redundant)
+        cps[i]->erase(cps[succ]);
+    }
+  });
   return fc;
 }
 
 }  // namespace FC
 
 #endif  // CLEAN_HPP_
-
@@ -93,7 +93,7 @@ void spawn_sub_descends(DTHandler & dth,
                  [dropped_idx](size_type idx) {return idx != dropped_idx;});
     if ((existing_cp = fc.find(cp_type(newidx.begin(), newidx.end(), 0)))) {
       DLOG(INFO) << "CP ALREADY FOUND - NO DT SPAWNED,SUCCS UPDATED\n";
-      existing_cp->add_successor(succ);
+      fc.add_incidence(existing_cp, succ);
     } else {
       auto new_ah(ah);
       new_ah.drop_point(new_ah.begin() + *it);
@@ -113,7 +113,10 @@ bool ball_is_empty(const PointCloud& pc, const Eigen::MatrixBase<Derived>& x,
                    const AffineHull& ah, const IgnoreFn& ignoreFn) {
   using size_type = typename PointCloud::size_type;
   using number_type = typename PointCloud::number_type;
-  thread_local std::vector<size_type> nn_indices(pc.size());
+  // the thread may have checked a smaller point cloud before
+  thread_local std::vector<size_type> nn_indices;
+  if (nn_indices.size() < std::size_t(pc.size()))
+    nn_indices.resize(pc.size());
   const number_type radius_sq = (pc[*ah.begin()] - x).squaredNorm();
   auto end = pc.radius_search(x, radius_sq, nn_indices.begin());
   end = std::remove_if(nn_indices.begin(), end, ignoreFn);
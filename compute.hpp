@@ -1,26 +1,364 @@
 #ifndef COMPUTE_HPP_
 #define COMPUTE_HPP_
 
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
 #include <utility>
 #include <vector>
 
 #include <glog/logging.h>
-#include <tbb/concurrent_unordered_set.h>
-#include <tbb/task_scheduler_init.h>
-#include <tbb/parallel_do.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/task_arena.h>
 
 #include "ascend_task.hpp"
+#include "checkpoint.hpp"
+#include "clean.hpp"
 #include "descend_task.hpp"
+#include "fingerprint_set.hpp"
 #include "flow_complex.hpp"
+#include "gabriel.hpp"
+#include "metrics.hpp"
+#include "options.hpp"
 #include "point_cloud.hpp"
+#include "qr_cache.hpp"
+#include "random.hpp"
+#include "region.hpp"
+#include "scheduler.hpp"
+#include "scratch_arena.hpp"
 #include "utility.hpp"
 #include "tbb.hpp"
 
 namespace FC {
 
 /**
-  @num_threads if negative, use Intel TBB default
+  @return whether the computation is to stop, see compute_options::cancel
+*/
+inline bool stop_requested(compute_options const& options) {
+  return options.cancel.cancelled() ||
+         std::chrono::steady_clock::now() >= options.deadline;
+}
+
+/**
+  @brief statistics of a computation of the flow complex
+*/
+struct compute_statistics {
+  // of the cache of affine hull factorizations (see --qr_cache_capacity)
+  qr_cache_statistics qr_cache;
+  // the largest number of tasks that waited for execution at once (not
+  // tracked by the locality-aware scheduler)
+  std::size_t peak_frontier = 0;
+  // of the sets that suppress duplicate tasks
+  fingerprint_set_statistics dedup;
+  // the number of tasks that were dropped since they are too far from the
+  // region of interest (see compute_options::region_min), or descend below
+  // r_min
+  std::size_t pruned_tasks = 0;
+  // the counters of the hot paths of this computation alone, see
+  // metrics_counts
+  metrics_snapshot metrics;
+};
+
+/**
+  @brief Processes the tasks created by seed(pool, num_threads, cache), and
+         all tasks they spawn, on the flow complex fc of pc. This is the part
+         of compute_flow_complex that does not depend on how it is seeded.
+  @param seed returns the initial tasks, which it allocates from pool. Its
+              ascend tasks may share the (optional) cache of factorizations.
+              Not called if options.resume is true, then the tasks of the
+              checkpoint are processed.
+  @param stats if not null, receives the statistics of the computation
+*/
+template <class PointCloud, class SeedFn>
+void process_tasks(PointCloud const& pc,
+                   flow_complex<typename PointCloud::number_type,
+                                typename PointCloud::size_type> & fc,
+                   compute_options const& options,
+                   compute_statistics * stats, SeedFn const& seed) {
+  using pc_type = PointCloud;
+  using number_type = typename pc_type::number_type;
+  using size_type = typename pc_type::size_type;
+  using ci_type = circumsphere_ident<size_type>;
+  using cp_type = critical_point<number_type, size_type>;
+  // the tasks count into blocks of this computation, whichever worker runs
+  // them
+  metrics_counts counts;
+
+  // 1) init data structures
+  // the circumsphere identifiers only suppress duplicate tasks, hence
+  // fingerprints of them suffice
+  using ci_container = fingerprint_set<size_type>;
+  ci_container infproxy_cont;
+  ci_container dci;
+  std::unique_ptr<qr_cache<number_type, size_type>> cache;
+  if (FLAGS_qr_cache_capacity > 0)
+    cache.reset(new qr_cache<number_type, size_type>(FLAGS_qr_cache_capacity));
+  // records the changes between two checkpoints
+  using journal_type = checkpoint_journal<task_variant<pc_type>>;
+  std::unique_ptr<journal_type> journal;
+  if (!options.checkpoint.empty())
+    journal.reset(new journal_type());
+  // 2) create the handlers for task communication
+  auto cih = [&journal, &dci] (ci_container & ci_store, ci_type ci) {
+    bool const is_new = ci_store.insert(ci.cbegin(), ci.cend());
+    if (!is_new)
+      metrics::add(metric::deduplicated_tasks);
+    else if (journal)
+      journal->record(&ci_store == &dci, ci.cbegin(), ci.cend());
+    return is_new;
+  };
+  auto acih = std::bind(cih, std::ref(infproxy_cont), std::placeholders::_1);
+  auto dcih = std::bind(cih, std::ref(dci), std::placeholders::_1);
+  
+  // 3) seed initial task(s)
+  // tasks live in pooled storage, the worker that finished a task recycles
+  // its node for the tasks it creates next
+  using task_type = task_variant<pc_type>;
+  task_pool<task_type> pool;
+  using item_t = task_type *;
+  int num_threads = options.num_threads;
+  if (num_threads < 0) num_threads = tbb::this_task_arena::max_concurrency();
+  std::vector<item_t> tasks;
+  if (options.resume) {
+    std::ifstream in(options.checkpoint);
+    if (!in)
+      throw std::runtime_error("could not open " + options.checkpoint);
+    tasks = load_checkpoint<task_type>(in, pc, fc, infproxy_cont, dci, pool,
+                                       cache.get());
+    LOG(INFO) << "resuming with " << tasks.size() << " tasks";
+  } else {
+    tasks = seed(pool, num_threads, cache.get());
+  }
+  // descends far from the region do not reach a critical point inside, they
+  // are dropped instead of spawned. This is a heuristic, not a bound: the
+  // critical points a descend reaches lie in the closure of the stable
+  // manifold of its start, which is not confined to its ball, the
+  // circumcenters of the ones found were within 1.8 radii of the start on
+  // random clouds of up to 4 dimensions. Hence the ball grown by the factor 2
+  // has to miss the region. The ascends are never dropped, their flow may go
+  // arbitrarily far. Likewise the descends below r_min.
+  region_box<number_type> const region(pc.dim(), options.region_min,
+                                       options.region_max);
+  number_type const sq_r_min = number_type(options.r_min) * options.r_min;
+  std::atomic<std::size_t> num_pruned(0);
+  auto const prune = [&] (item_t t) {
+    if (!t->is_descend() ||
+        (region.meets(t->location(), 4 * t->sq_radius()) &&
+         !(sq_r_min > 0 && t->sq_radius() < sq_r_min)))
+      return false;
+    num_pruned.fetch_add(1, std::memory_order_relaxed);
+    pool.destroy(t);
+    return true;
+  };
+  tasks.erase(std::remove_if(tasks.begin(), tasks.end(), prune), tasks.end());
+  // the checkpoint starts with the whole state, which also drops the blocks
+  // of the one resumed from, and the changes are appended from here on
+  auto const observer = fc.observer();
+  if (journal) {
+    replace_file(options.checkpoint, [&] (std::ostream & os) {
+      save_checkpoint(os, fc, infproxy_cont, dci, tasks);
+    });
+    fc.set_observer([&journal, observer] (cp_type const& cp,
+                                          cp_type const* succ) {
+      journal->record(cp, succ);
+      if (observer)
+        observer(cp, succ);
+    });
+  }
+  // every worker owns a scratch arena for the temporaries of its tasks
+  using arena_type = scratch_arena<pc_type>;
+  tbb::enumerable_thread_specific<arena_type> arenas([&pc] {
+    return arena_type(pc);
+  });
+  // once cancelled, the workers drain the schedulers by discarding the
+  // tasks, which the final checkpoint keeps
+  std::atomic<bool> stopped(false);
+  std::atomic<std::size_t> num_discarded(0);
+  std::mutex discarded_mutex;
+  std::vector<item_t> discarded;
+  auto const discard = [&] (item_t t) {
+    if (!stopped.load(std::memory_order_relaxed)) {
+      if (!stop_requested(options))
+        return false;
+      stopped.store(true, std::memory_order_relaxed);
+    }
+    num_discarded.fetch_add(1, std::memory_order_relaxed);
+    if (journal) {
+      std::lock_guard<std::mutex> lock(discarded_mutex);
+      discarded.push_back(t);
+    } else {
+      pool.destroy(t);
+    }
+    return true;
+  };
+  // a task that throws stops the computation like a cancellation, the first
+  // error is rethrown once the workers returned. The task itself is dropped,
+  // as it would fail again.
+  std::exception_ptr failure;
+  auto const fail = [&] (item_t t) {
+    {
+      std::lock_guard<std::mutex> lock(discarded_mutex);
+      if (!failure)
+        failure = std::current_exception();
+    }
+    stopped.store(true, std::memory_order_relaxed);
+    num_discarded.fetch_add(1, std::memory_order_relaxed);
+    pool.destroy(t);
+  };
+  CHECK(options.checkpoint.empty() || !options.locality_aware)
+      << "checkpoints need the default scheduler";
+  // 4) process all tasks
+  std::size_t peak_frontier = 0;
+  tbb::task_arena workers(num_threads);
+  workers.execute([&] {
+    if (options.locality_aware) {
+      morton_code<number_type> const code(pc.bounding_box_min(),
+                                          pc.bounding_box_max());
+      locality_scheduler<task_type> scheduler(num_threads, code.bits());
+      auto spawn = [&] (item_t t) {
+        if (!prune(t))
+          scheduler.push(code(t->location()), t);
+      };
+      auto inline_ascends = [] {return false;};
+      for (auto t : tasks)
+        spawn(t);
+      scheduler.run([&] (item_t item) {
+        if (discard(item))
+          return;
+        try {
+          metrics::scope const counting(counts.local());
+          execute_task(item, spawn, inline_ascends, pool, fc, acih, dcih,
+                       arenas.local());
+        } catch (...) {
+          fail(item);
+        }
+      });
+    } else {
+      // the level of a task is the size of its affine hull: descends of
+      // smaller affine hulls are closer to the minima and spawn less work
+      bounded_scheduler<task_type> scheduler(num_threads, pc.dim() + 2,
+                                             options.frontier_budget);
+      for (std::size_t i = 0; i < tasks.size(); ++i)
+        scheduler.push(tasks[i], tasks[i]->level(), i);
+      // the workers only hold while the changes since the last checkpoint
+      // are taken and the waiting tasks are written, the changes are
+      // appended to the file while they continue
+      std::mutex checkpoint_mutex;
+      std::condition_variable checkpoint_cv;
+      bool done = false;
+      std::thread checkpointer;
+      if (!options.checkpoint.empty()) {
+        checkpointer = std::thread([&] {
+          auto const interval = std::chrono::duration<double>(
+              options.checkpoint_interval);
+          std::unique_lock<std::mutex> lock(checkpoint_mutex);
+          while (!checkpoint_cv.wait_for(lock, interval, [&] {return done;})) {
+            std::ostringstream waiting_tasks;
+            auto const start = std::chrono::steady_clock::now();
+            // once stopped, the final checkpoint follows the workers
+            bool complete = true;
+            scheduler.pause([&] (std::vector<item_t> const& waiting) {
+              complete = !stopped.load();
+              if (complete) {
+                journal->cut();
+                save_tasks(waiting_tasks, waiting);
+              }
+            });
+            if (!complete)
+              break;
+            auto const held = std::chrono::steady_clock::now() - start;
+            std::ofstream f(options.checkpoint, std::ios::app);
+            journal->save_delta(f, waiting_tasks.str());
+            if (!f.flush())
+              LOG(ERROR) << "could not write to file " << options.checkpoint;
+            LOG(INFO) << "checkpoint of " << fc.size()
+                      << " critical points, the workers held for "
+                      << std::chrono::duration<double>(held).count() << " s";
+          }
+        });
+      }
+      scheduler.run([&] (item_t item, std::size_t worker) {
+        auto spawn = [&] (item_t t) {
+          if (!prune(t))
+            scheduler.push(t, t->level(), worker);
+        };
+        // beyond the budget, ascends wait until the lower levels are done
+        auto defer_ascends = [&scheduler] {return scheduler.over_budget();};
+        if (discard(item))
+          return;
+        try {
+          metrics::scope const counting(counts.local());
+          execute_task(item, spawn, defer_ascends, pool, fc, acih, dcih,
+                       arenas.local());
+        } catch (...) {
+          fail(item);
+        }
+      });
+      if (checkpointer.joinable()) {
+        {
+          std::lock_guard<std::mutex> lock(checkpoint_mutex);
+          done = true;
+        }
+        checkpoint_cv.notify_one();
+        checkpointer.join();
+      }
+      peak_frontier = scheduler.peak_frontier();
+    }
+  });
+  fc.set_observer(observer);
+  if (num_discarded > 0) {
+    LOG(WARNING) << "the computation was " << (failure ? "aborted" : "cancelled")
+                 << ", " << num_discarded << " tasks were discarded";
+    fc.set_num_pending_tasks(num_discarded);
+  }
+  // the computation resumes from the final checkpoint, a complete one needs
+  // none
+  if (journal && num_discarded > 0) {
+    journal->cut();
+    std::ostringstream waiting_tasks;
+    save_tasks(waiting_tasks, discarded);
+    std::ofstream f(options.checkpoint, std::ios::app);
+    journal->save_delta(f, waiting_tasks.str());
+    if (f.flush())
+      LOG(INFO) << "final checkpoint with " << discarded.size() << " tasks";
+    else
+      LOG(ERROR) << "could not write to file " << options.checkpoint;
+  } else if (journal) {
+    std::remove(options.checkpoint.c_str());
+  }
+  for (auto t : discarded)
+    pool.destroy(t);
+  if (stats) {
+    if (cache)
+      stats->qr_cache = cache->statistics();
+    stats->peak_frontier = peak_frontier;
+    stats->dedup = infproxy_cont.statistics();
+    stats->dedup += dci.statistics();
+    stats->pruned_tasks = num_pruned.load();
+    stats->metrics = counts.snapshot();
+  }
+  if (failure)
+    std::rethrow_exception(failure);
+}
+
+/**
+  @options see compute_options
+  @stats if not null, receives the statistics of the computation
+  @observer if set, is told about the critical points and incidences as they
+            are found, except for the minima (see flow_complex::set_observer).
+            The ones outside of max_index or the region are reported as well.
 */
 template <typename size_type,    // type that is capable of holding the indices
                                  // of the critical points
@@ -30,49 +368,137 @@ template <typename size_type,    // type that is capable of holding the indices
 flow_complex<typename base_t<decltype((*PointIterator())[0])>::type,
              size_type>
 compute_flow_complex (PointIterator begin, PointIterator end,
-                      dim_type dim, int num_threads) {
+                      dim_type dim, compute_options const& options,
+                      compute_statistics * stats = nullptr,
+                      typename flow_complex<
+                          typename base_t<decltype((*PointIterator())[0])>::type,
+                          size_type>::observer_type observer = nullptr) {
   DLOG(INFO) << "*****************COMPUTE-START*************************\n";
   using number_type = typename base_t<decltype((*PointIterator())[0])>::type;
   using fc_type = flow_complex<number_type, size_type>;
   using pc_type = point_cloud<number_type, size_type, Aligned>;
   using at_type = ascend_task<pc_type>;
-  using dt_type = descend_task<pc_type>;
-  using ci_type = circumsphere_ident<size_type>;
+  using task_type = task_variant<pc_type>;
 
-  // 1) init data structures
   pc_type pc(begin, end, dim);
   fc_type fc(dim, pc.size());
-
-  using ci_container = tbb::concurrent_unordered_set<ci_type, CIHash>;
-  ci_container infproxy_cont;
-  ci_container dci;
-  // 2) create the handlers for task communication
-  auto cih = [] (ci_container & ci_store, ci_type ci) {
-    return ci_store.insert(ci).second;
-  };
-  auto acih = std::bind(cih, std::ref(infproxy_cont), std::placeholders::_1);
-  auto dcih = std::bind(cih, std::ref(dci), std::placeholders::_1);
-  
-  // 3) seed initial ascend task(s)
-  using item_t = std::shared_ptr<abstract_task<pc_type>>;
-  using feeder_t = tbb::parallel_do_feeder<item_t>;
-  if (num_threads < 0) num_threads = tbb::task_scheduler_init::default_num_threads();
-  std::vector<item_t> tasks;
-  tbb::task_scheduler_init init(num_threads);
-  for (int i = 1; i <= num_threads; ++i)
-    tasks.push_back(item_t(make_task_wrapper(at_type(pc), acih)));
-  // 4) process all tasks
-  tbb::parallel_do(tasks.begin(), tasks.end(), [&](item_t item, feeder_t & f) {
-    using ttb_at_t = tbb_task_wrapper<at_type, decltype(acih)>;
-    using ttb_dt_t = tbb_task_wrapper<dt_type, decltype(dcih)>;
-    auto ath = [&] (at_type && at) {f.add(item_t(new ttb_at_t(std::move(at), acih)));};
-    auto dth = [&] (dt_type && dt) {f.add(item_t(new ttb_dt_t(std::move(dt), dcih)));};
-    item->execute(ath, dth, fc);
+  fc.set_observer(std::move(observer));
+  region_box<number_type> const region(pc.dim(), options.region_min,
+                                       options.region_max);
+  if (options.r_max > 0)
+    fc.set_sq_radius_cutoff(number_type(options.r_max) * options.r_max);
+  // the kd-tree is built in any case, the phases after it stop early
+  auto const stop = [&options] {return stop_requested(options);};
+  metrics_counts gabriel_counts;
+  std::size_t num_skipped = 0;
+  // the minima are known, the Gabriel edges are tested directly
+  if (!options.resume && 0 != options.max_index &&
+      (1 == options.max_index || options.r_max > 0)) {
+    int num_threads = options.num_threads;
+    if (num_threads < 0) num_threads = tbb::this_task_arena::max_concurrency();
+    tbb::task_arena workers(num_threads);
+    workers.execute([&] {
+      num_skipped = insert_gabriel_edges(pc, fc, &gabriel_counts, stop);
+    });
+  }
+  if (0 <= options.max_index && options.max_index < 2) {
+    fc.set_observer(nullptr);
+    fc.set_num_pending_tasks(num_skipped);
+    if (region.bounded())
+      restrict_to_region(fc, pc, region, options.region_boundary);
+    if (stats) {
+      *stats = compute_statistics();
+      stats->metrics = gabriel_counts.snapshot();
+    }
+    return fc;
+  }
+  // a checkpoint would resume without the edges that were skipped
+  compute_options const* task_options = &options;
+  compute_options unsaved;
+  if (num_skipped > 0 && !options.checkpoint.empty()) {
+    LOG(WARNING) << "the computation was stopped in the search of the "
+                    "Gabriel edges, no checkpoint is written";
+    unsaved = options;
+    unsaved.checkpoint.clear();
+    task_options = &unsaved;
+  }
+  process_tasks(pc, fc, *task_options, stats,
+                [&] (task_pool<task_type> & pool, int num_threads,
+                     typename affine_hull<pc_type>::cache_type * cache) {
+    std::vector<task_type *> tasks;
+    // every initial ascend task draws from its own random stream
+    std::uint64_t const seed = options.seed < 0 ? random_seed() : options.seed;
+    DLOG(INFO) << "seed = " << seed << std::endl;
+    std::uint64_t i = 0;
+    if (region.bounded()) {
+      // the ascends start at the points in the region, or at its center
+      for (size_type idx = 0; idx < pc.size(); ++idx) {
+        if (!region.contains(pc[idx]))
+          continue;
+        counter_rng rng(seed, ++i);
+        tasks.push_back(pool.create(at_type(pc, pc[idx], rng, cache)));
+      }
+      if (tasks.empty()) {
+        counter_rng rng(seed, ++i);
+        tasks.push_back(pool.create(at_type(pc, region.center(), rng, cache)));
+      }
+    } else {
+      while (i < std::uint64_t(num_threads)) {
+        counter_rng rng(seed, ++i);
+        tasks.push_back(pool.create(at_type(pc, rng, cache)));
+      }
+    }
+    // below the cutoff, the union of the balls may fall apart into regions
+    // that no ascend crosses, hence an ascend starts at every Gabriel edge
+    if (options.r_max > 0) {
+      for (auto const& cp : fc) {
+        if (cp.is_max_at_inf() || 1 != cp.index())
+          continue;
+        counter_rng rng(seed, ++i);
+        auto const& p = pc[*cp.idx_begin()];
+        auto const& q = pc[*std::next(cp.idx_begin())];
+        tasks.push_back(pool.create(at_type(pc, number_type(0.5) * (p + q),
+                                            rng, cache)));
+      }
+    }
+    return tasks;
   });
+  if (stats)
+    stats->metrics += gabriel_counts.snapshot();
+  fc.set_num_pending_tasks(fc.num_pending_tasks() + num_skipped);
+  fc.set_observer(nullptr);
+  if (0 <= options.max_index && options.max_index < pc.dim())
+    truncate(fc, size_type(options.max_index));
+  if (region.bounded()) {
+    // the redundancy of an incidence may only show through critical points
+    // outside the region. Unlike the other trims, the cleaning takes more
+    // than linear time, it is skipped once stopped.
+    if (options.region_boundary && !stop())
+      fc = clean_incidences(std::move(fc));
+    else if (options.region_boundary)
+      fc.set_num_pending_tasks(fc.num_pending_tasks() + 1);
+    restrict_to_region(fc, pc, region, options.region_boundary);
+  }
   
   return fc;
 }
 
+/**
+  @num_threads if negative, use Intel TBB default
+*/
+template <typename size_type, bool Aligned = false, typename PointIterator,
+          typename dim_type>
+flow_complex<typename base_t<decltype((*PointIterator())[0])>::type,
+             size_type>
+compute_flow_complex (PointIterator begin, PointIterator end,
+                      dim_type dim, int num_threads,
+                      compute_statistics * stats = nullptr) {
+  compute_options options;
+  options.num_threads = num_threads;
+  return compute_flow_complex<size_type, Aligned>(begin, end, dim, options,
+                                                  stats);
+}
+
 }  // namespace FC
 
 #endif  // COMPUTE_HPP_
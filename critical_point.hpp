@@ -54,25 +54,27 @@ public:
     _successors.push_back(succ);
   }
   
-  // constructor for cp at inf
-  critical_point(size_type index)
-    : _index(index) {
+  // constructor for cp at inf, or for the stand-in of the flows that were
+  // cut off (see flow_complex::max_at_cutoff)
+  critical_point(size_type index, bool cut_off = false)
+    : _cut_off(cut_off), _index(index) {
     DLOG(INFO) << "**CP-INF-CTOR: " << this << std::endl;
   }
 
   // constructors and assignment-operators
   critical_point(critical_point && tmp) : _indices(std::move(tmp._indices)),
-    _successors(std::move(tmp._successors)) {
+    _successors(std::move(tmp._successors)), _cut_off(tmp._cut_off) {
     DLOG(INFO) << "**CP-MOVE-CTOR: " << this << std::endl;
-    if (is_max_at_inf())
+    if (_indices.empty())
       _index = std::move(tmp._index);
     else
       _sq_dist = std::move(tmp._sq_dist);
   }
   
   critical_point(critical_point const& orig)
-    : _indices(orig._indices), _successors(orig._successors) {
-    if (orig.is_max_at_inf())
+    : _indices(orig._indices), _successors(orig._successors),
+      _cut_off(orig._cut_off) {
+    if (_indices.empty())
       _index = orig._index;
     else
       _sq_dist = orig._sq_dist;
@@ -100,10 +102,15 @@ public:
   }
   
   // modifiers
-  void add_successor(self_type * succ) {
+  /**
+    @return false if succ was a successor already
+  */
+  bool add_successor(self_type * succ) {
     tbb::mutex::scoped_lock lock(_succ_mutex);
-    if (succ_end() == std::find(succ_begin(), succ_end(), succ))
-      _successors.push_back(succ);
+    if (succ_end() != std::find(succ_begin(), succ_end(), succ))
+      return false;
+    _successors.push_back(succ);
+    return true;
   }
   
   // this method is used by the cleansing tool only, and so far not in a multi-
@@ -121,25 +128,35 @@ public:
 
   // info
   bool is_max_at_inf() const noexcept {
-    return _indices.empty();
+    return _indices.empty() && !_cut_off;
+  }
+  
+  /**
+    @return true for the stand-in of the flows that were cut off at the
+            radius cutoff, which has no indices either
+  */
+  bool is_cut_off() const noexcept {
+    return _cut_off;
   }
   
   /**
-    @return if is_max_at_inf() is true, then the result is undefined
+    @return if is_max_at_inf() or is_cut_off() is true, then the result is
+            undefined
   */
   number_type sq_dist() const noexcept {
     return _sq_dist;
   }
   
   size_type index() const noexcept {
-    return (is_max_at_inf() ? _index :
-                              convertSafelyTo<size_type>(_indices.size()) - 1);
+    return (_indices.empty() ? _index :
+                               convertSafelyTo<size_type>(_indices.size()) - 1);
   }
 
 private:
   idx_container  _indices;
   succ_container _successors;
   tbb::mutex     _succ_mutex;
+  bool           _cut_off = false;
   union {
     _number_type _sq_dist;  // for regular cps
     _size_type   _index;   // for cp at inf
@@ -159,7 +176,9 @@ bool operator==(critical_point<number_type, size_type> const& lhs,
   // two instances with different index), however this should evaluate to
   // false then
   return ((lhs.is_max_at_inf() && rhs.is_max_at_inf()) ||     // both cps at inf
-          ((!lhs.is_max_at_inf() && !rhs.is_max_at_inf()) &&  // both regular
+          (lhs.is_cut_off() && rhs.is_cut_off()) ||           // both cut off
+          ((lhs.idx_begin() != lhs.idx_end() &&               // both regular
+            rhs.idx_begin() != rhs.idx_end()) &&
            (lhs.index() == rhs.index()) &&  // avoids comparison below (somet.)
             std::equal(lhs.idx_begin(), lhs.idx_end(), rhs.idx_begin())
            )
@@ -187,6 +206,8 @@ template <typename nt, typename st>
 std::ostream & operator<<(std::ostream & os, critical_point<nt, st> const& cp) {
   if (cp.is_max_at_inf()) {
     os << "inf ";
+  } else if (cp.is_cut_off()) {
+    os << "cutoff ";
   } else {
     for (auto it = cp.idx_begin(); it != cp.idx_end(); ++it)
       os << *it << " ";
@@ -1,7 +1,10 @@
 #ifndef DESCEND_TASK_HPP_
 #define DESCEND_TASK_HPP_
 
+#include <istream>
 #include <ostream>
+#include <stdexcept>
+#include <string>
 #include <utility>
 #include <vector>
 
@@ -12,6 +15,8 @@
 #include "common.hpp"
 #include "critical_point.hpp"
 #include "flow_complex.hpp"
+#include "metrics.hpp"
+#include "scratch_arena.hpp"
 #include "update_ray.hpp"
 #include "utility.hpp"
 #include "vertex_filter.hpp"
@@ -46,6 +51,28 @@ public:
     _location.swap(location);
   }
   
+  /**
+    @brief restores a descend task written by save(), e.g. from a checkpoint.
+           Its successor has to be in fc.
+  */
+  descend_task(point_cloud_type const& pc, fc_type & fc, std::istream & is,
+               typename affine_hull<point_cloud_type>::cache_type * cache = nullptr)
+    : _ah(pc, cache), _location(), _succ(nullptr) {
+    std::vector<size_type> idx;
+    load_range(is, idx);
+    for (auto const i : idx)
+      _ah.append_point(i);
+    load_range(is, _location);
+    load_range(is, idx);
+    bool cut_off = false;
+    is >> cut_off;
+    _succ = cut_off ? fc.max_at_cutoff()
+                    : idx.empty() ? fc.max_at_inf()
+                                  : fc.find(cp_type(idx.begin(), idx.end(), 0));
+    CHECK(_succ) << "the successor of a restored descend task is missing";
+    load_range(is, _ignore_indices);
+  }
+
   descend_task(descend_task && tmp)
     : _ah(std::move(tmp._ah)), _location(), _succ(tmp._succ),
       _ignore_indices(std::move(tmp._ignore_indices)) {
@@ -71,19 +98,41 @@ public:
   descend_task(descend_task const&) = delete;
   descend_task & operator=(descend_task const&) = delete;
   
+  eigen_vector const& location() const {
+    return _location;
+  }
+  
+  affine_hull<point_cloud_type> const& hull() const {
+    return _ah;
+  }
+
+  /**
+    @brief writes the state of the task to os, see save_range. The successor
+           is written by its indices, which are none for the maximum at
+           infinity and for the cut off flows, and whether it is the latter.
+  */
+  void save(std::ostream & os) const {
+    save_range(os, _ah.begin(), _ah.end());
+    save_range(os, _location.data(), _location.data() + _location.size());
+    save_range(os, _succ->idx_begin(), _succ->idx_end());
+    os << ' ' << _succ->is_cut_off();
+    save_range(os, _ignore_indices.begin(), _ignore_indices.end());
+  }
+  
   void add_ignore_idx(size_type idx) {
     _ignore_indices.push_back(idx);
   }
   
   template <class DTHandler, class ATHandler, class CIHandler>
   void execute(ATHandler & ath, DTHandler & dth, fc_type & fc,
-               CIHandler & cih) {
+               CIHandler & cih, scratch_arena<point_cloud_type> & arena) {
+    metrics::add(metric::descend_tasks);
     auto const& pc = _ah.pc();
-    eigen_vector driver(pc.dim());
-    eigen_vector lambda(pc.dim() + 1);
-    thread_local std::vector<size_type> idx_store(pc.size());
-    std::vector<size_type> nnvec(pc.dim() + 1);
-    eigen_vector ray;
+    auto & driver = arena.driver;
+    auto & lambda = arena.lambda;
+    auto & idx_store = arena.idx_store;
+    auto & nnvec = arena.nnvec;
+    auto & ray = arena.ray;
 
     update_ray<RAY_DIR::TO_DRIVER>(_ah, _location, lambda, driver, ray);
     DLOG(INFO) << "DESCEND-TASK STARTS: address = " << this << std::endl
@@ -103,10 +152,12 @@ public:
       size_type const max_num_nn = pc.dim() + 1 - _ah.size();
       nn = nearest_neighbor_along_ray(_location, ray, pc[*_ah.begin()], vf,
                                       nnvec.begin(),
-                                      std::next(nnvec.begin(), max_num_nn));
+                                      std::next(nnvec.begin(), max_num_nn),
+                                      arena.nn);
     } catch(std::exception & e) {
-      std::cerr << "DESCEND-TASK error: " << e.what() << std::endl;
-      std::exit(EXIT_FAILURE);
+      // the computation stops with a final checkpoint, see process_tasks
+      throw std::runtime_error(std::string("descend task failed: ") +
+                               e.what());
     }
     auto & pos_offsets = idx_store;
     if (nn.first == nnvec.begin() || nn.second > 1.0) {
@@ -130,27 +181,25 @@ public:
             // update incidences of the adjacent minima, of this gabriel edge
             DCHECK(1 == new_succ->index());
             auto idx_it = new_succ->idx_begin();
-            fc.minimum(*idx_it)->add_successor(new_succ);
-            fc.minimum(*++idx_it)->add_successor(new_succ);
+            fc.add_incidence(fc.minimum(*idx_it), new_succ);
+            fc.add_incidence(fc.minimum(*++idx_it), new_succ);
           }
           // search for the adjacent maximum, if we found a d-1 critical point
           if (_ah.size() == pc.dim()) {
             DLOG(INFO) << "SPAWN ASCEND TO MAX ON OTHER SIDE\n";
             using at = ascend_task<point_cloud_type>;
             DLOG(INFO) << "t = " << nn.second << std::endl;
-            // TODO actually we have all the information we need at this point:
-            //      if (nn.first == nnvec.begin()) the maximum on the other side is
-            //      inf (not true -> radius search confined search to small set of test indices ...),
-            //      otherwise it's a possible max-candidate formed by all the
-            //      points in _ah and *nn.first: we could just call the member
-            //      simplex-case-upflow ascend task then --> saves another
-            //      nn-along-ray search
-            ath(at(std::move(_ah), eigen_vector(driver), std::move(ray)));
+            // the stopper beyond the driver is not known at this point: the
+            // vertex filter confined the candidates to the ball at the
+            // driver, i.e. to points that stop the ray before it.
+            // The handler may execute the ascend right away using the same
+            // arena, hence this has to be the last use of the arena.
+            ath(at(std::move(_ah), eigen_vector(driver), eigen_vector(ray)));
           }
         } else {
           // update incidences of insert_pair.second
           auto * already_found_cp = insert_pair.second;
-          already_found_cp->add_successor(_succ);
+          fc.add_incidence(already_found_cp, _succ);
         }
       } else {
         DLOG(INFO) << "ONLY AFFINE HULL\n";
@@ -6,13 +6,15 @@
 #include <cmath>
 
 #include <algorithm>
+#include <limits>
 #include <ostream>
 #include <vector>
-#include <numeric>
 
 #include <Eigen/Core>
 #include <glog/logging.h>
 
+#include "predicates.hpp"
+
 namespace FC {
 
 template <typename _number_type>
@@ -21,127 +23,124 @@ class dynamic_qr;
 template <typename number_type>
 std::ostream & operator<<(std::ostream &, dynamic_qr<number_type> const&);
 
+/**
+  @brief thin QR decomposition A = Q * R of a num_rows x num_cols matrix A,
+         that can be updated when appending or deleting columns of A, or
+         when adding a rank-one matrix to A.
+
+         Only the num_cols columns of Q that span the column space of A are
+         stored, and R is stored as a num_cols x num_cols upper triangular
+         matrix. Hence the memory consumption and the cost of all updates
+         and of solve() is O(num_rows * num_cols) instead of O(num_rows^2).
+         The columns of Q are extended via Gram-Schmidt with a single
+         reorthogonalization step ("twice is enough"), whereas deleting
+         columns and rank-one updates use Givens rotations.
+*/
 template <typename _number_type>
 class dynamic_qr {
   using eigen_vector = Eigen::Matrix<_number_type, Eigen::Dynamic, 1>;
-  using eigen_map = Eigen::Map<eigen_vector>;
   using eigen_mat = Eigen::Matrix<_number_type, Eigen::Dynamic, Eigen::Dynamic>;
+  using eigen_map = Eigen::Map<eigen_vector>;
+  using eigen_cmap = Eigen::Map<eigen_vector const>;
+  using eigen_mat_cmap = Eigen::Map<eigen_mat const>;
 public:
   typedef _number_type number_type;
   typedef std::size_t  size_type;
 
   /**
     @brief will create a dynamic qr for at most num_rows columns
-  */    
+  */
   dynamic_qr(size_type num_rows)
-    : _q(eigen_mat::Identity(num_rows, num_rows)),
-      _r_raw(new number_type[num_rows * num_rows]),
-      _r_begin(new number_type * [num_rows]), _r_end(_r_begin) {
+    : _num_rows(num_rows), _num_cols(0), _q(), _r() {
     DLOG(INFO) << "**QR-CTOR " << this << std::endl;
     assert(num_rows > 0);
-    std::vector<size_type> offsets(num_rows);
-    std::iota(offsets.begin(), offsets.end(), 0);
-    init_row_ptr(offsets.begin());
   }
-  
+
   // copy-constructor
   dynamic_qr(dynamic_qr const& orig)
-    // note: orig.num_rows() == maximum number of columns possible
-    : _q(orig._q), _r_raw(nullptr),
-      _r_begin(new number_type * [orig.num_rows()]),
-      _r_end(_r_begin + orig.num_cols()) {
+    : _num_rows(orig._num_rows), _num_cols(orig._num_cols), _q(orig._q),
+      _r(orig._r) {
     DLOG(INFO) << "**QR-COPY-CTOR " << this << std::endl;
-    size_type const num_elements = orig.num_rows() * orig.num_rows();
-    _r_raw = new number_type[num_elements];
-
-    // since some column pointers might have been swapped,
-    // we need to copy the exact same offsets
-    std::vector<size_type> offsets(num_rows());
-    for (size_type i = 0; i < offsets.size(); ++i)
-      offsets[i] = (orig._r_begin[i] - orig._r_raw) / orig.num_rows();
-    init_row_ptr(offsets.begin());
-    
-    std::copy(orig._r_raw, orig._r_raw + num_elements, _r_raw);
-    
-    CHECK(num_rows() == orig.num_rows());
-    CHECK(num_cols() == orig.num_cols());
-    CHECK(_q == orig._q);
-    DCHECK(std::equal(_r_raw, _r_raw + num_elements, orig._r_raw));
   }
 
   // move-constructor
   dynamic_qr(dynamic_qr && tmp)
-    : _q(), _r_raw(tmp._r_raw), _r_begin(tmp._r_begin), _r_end(tmp._r_end) {
+    : _num_rows(tmp._num_rows), _num_cols(tmp._num_cols),
+      _q(std::move(tmp._q)), _r(std::move(tmp._r)) {
     DLOG(INFO) << "**QR-MOVE-CTOR " << this << std::endl;
-    _q.swap(tmp._q);
-    // ownership has been transferred
-    tmp._r_raw = nullptr;
-    tmp._r_begin = nullptr;
+    tmp._num_cols = 0;
   }
-  
+
   // move-assignment
   dynamic_qr & operator=(dynamic_qr && tmp) {
     DLOG(INFO) << "**QR-MOVE-ASSIGN " << this << std::endl;
     if (this != &tmp) {
-      _q.swap(tmp._q);
-      _r_raw = tmp._r_raw;
-      _r_begin = tmp._r_begin;
-      _r_end = tmp._r_end;
-      // ownership has been transferred
-      tmp._r_raw = nullptr;
-      tmp._r_begin = nullptr;
+      _num_rows = tmp._num_rows;
+      _num_cols = tmp._num_cols;
+      _q = std::move(tmp._q);
+      _r = std::move(tmp._r);
+      tmp._num_cols = 0;
     }
     return *this;
   }
 
   dynamic_qr & operator=(dynamic_qr const&) = delete;
-  
+
   size_type num_rows() const noexcept {
-    assert(_q.rows() >= 0);
-    return _q.rows();
+    return _num_rows;
   }
-  
+
   size_type num_cols() const noexcept {
-    assert(_r_end >= _r_begin);
-    return _r_end - _r_begin;
+    return _num_cols;
   }
-  
+
   template <typename DerivedVector>
   void append_column(Eigen::MatrixBase<DerivedVector> const& col) {
     assert(num_cols() < num_rows());
-    eigen_map new_col(*_r_end, num_rows());
-    new_col = _q.transpose() * col;
-    number_type c, s;
-    for (size_type i = num_rows() - 1; i-- > num_cols();) {
-      // i is the index of 'a' in the givens routine
-      givens(new_col[i], new_col[i + 1], &c, &s);  // c and s
-      // Note: we don't use Eigen here for the rotation matrix multiplication
-      //       because due to aliasing, we would have to evaluate the rotation
-      //       result into a temporary and assign afterwards.
-      update_q(c, s, i);
-      apply_half_givens(c, s, *_r_end, i);  // update R
-      // new_col[i + 1] is implicitely set to 0
+    size_type const k = num_cols();
+    _q.resize((k + 1) * num_rows());
+    _r.resize((k + 1) * num_rows());
+    eigen_map new_q(q_col(k), num_rows());
+    eigen_map new_r(r_col(k), k + 1);
+    new_q = col;
+    number_type const col_norm = new_q.norm();
+    if (k > 0) {
+      // classical Gram-Schmidt, followed by one modified Gram-Schmidt sweep
+      // to restore the orthogonality lost due to cancellation
+      eigen_mat_cmap const q_old(_q.data(), num_rows(), k);
+      new_r.head(k).noalias() = q_old.transpose() * new_q;
+      new_q.noalias() -= q_old * new_r.head(k);
+      for (size_type j = 0; j < k; ++j) {
+        number_type const s = eigen_cmap(q_col(j), num_rows()).dot(new_q);
+        new_r[j] += s;
+        new_q -= s * eigen_cmap(q_col(j), num_rows());
+      }
     }
-    ++_r_end;
+    number_type const rho = new_q.norm();
+    new_r[k] = rho;
+    ++_num_cols;
+    if (rho > std::numeric_limits<number_type>::epsilon() * col_norm)
+      new_q /= rho;
+    else  // col is (numerically) in the span of Q, keep Q orthonormal anyway
+      complete_basis(k);
   }
 
   void delete_column(size_type pos) {
     assert(pos >= 0);
     assert(pos < num_cols());
-    if (pos != num_cols() - 1) {
-      // move all columns right of pos one to the left
-      number_type * tmp = _r_begin[pos];
-      for (size_type i = pos, max = num_cols() - 1; i < max; ++i)
-        _r_begin[i] = _r_begin[i + 1];
-      --_r_end;  // num_cols() is now up-to-date again
-      *_r_end = tmp;  // restored the address of the deleted column
-      // R is now upper Hessenberg starting at column pos
-      hessenberg_update(pos, num_cols());
-    } else {
-      --_r_end;
-    }
+    size_type const k = num_cols();
+    // move all columns right of pos one to the left
+    std::copy(_r.begin() + (pos + 1) * num_rows(), _r.end(),
+              _r.begin() + pos * num_rows());
+    --_num_cols;
+    // R is now upper Hessenberg starting at column pos
+    hessenberg_update(pos, num_cols());
+    // the last row of R is now zero, i.e. the last column of Q is obsolete
+    _q.resize(num_cols() * num_rows());
+    _r.resize(num_cols() * num_rows());
+    DCHECK(k == num_cols() + 1);
   }
-  
+
   /**
     @brief updates the QR decomposition for A + u * v^T
   */
@@ -151,32 +150,55 @@ public:
                        Eigen::MatrixBase<DerivedVector2> const& v) {
     assert(size_type(u.rows()) == num_rows());
     assert(size_type(v.rows()) == num_cols());
-    
+    assert(num_cols() > 0);
+    size_type const k = num_cols();
+    // split u into its components within and orthogonal to the span of Q
+    eigen_vector w(k + 1);
+    eigen_vector res(u);
+    eigen_mat_cmap const q_thin(_q.data(), num_rows(), k);
+    w.head(k).noalias() = q_thin.transpose() * res;
+    res.noalias() -= q_thin * w.head(k);
+    for (size_type j = 0; j < k; ++j) {
+      number_type const s = eigen_cmap(q_col(j), num_rows()).dot(res);
+      w[j] += s;
+      res -= s * eigen_cmap(q_col(j), num_rows());
+    }
+    number_type const rho = res.norm();
+    // if u is not contained in the span of Q, Q temporarily gets an
+    // additional column and R an additional (zero) row
+    bool const extended = k < num_rows() &&
+        rho > std::numeric_limits<number_type>::epsilon() * u.norm();
+    size_type const m = extended ? k + 1 : k;
+    if (extended) {
+      _q.resize((k + 1) * num_rows());
+      eigen_map(q_col(k), num_rows()) = res / rho;
+      w[k] = rho;
+    }
     // we now need to actually zero the subdiagonal entries, since we
     // access those during the updates of R
-    for (size_type i = 0; i < (num_cols() - 1); ++i)
-      _r_begin[i][i + 1] = 0;
-    bool const is_not_square = num_rows() > num_cols();
-    if (is_not_square)  // only the the last column has a sub-diagonal element
-      _r_begin[num_cols() - 1][num_cols()] = 0;
-    
-    eigen_vector w = _q.transpose() * u;
-    number_type c ,s;
-    for (size_type i = num_rows() - 1; i-- > 0;) {
+    for (size_type i = 0; i + 1 < k; ++i)
+      r_col(i)[i + 1] = 0;
+    if (extended)  // only the the last column has a sub-diagonal element
+      r_col(k - 1)[k] = 0;
+
+    number_type c, s;
+    for (size_type i = m - 1; i-- > 0;) {
       givens(w[i], w[i + 1], &c, &s);
       apply_half_givens(c, s, w.data(), i);  // clear element i + 1 of w
-      if (i < num_cols())
-        apply_givens(c, s, i, i);
+      apply_givens(c, s, i, i);
       update_q(c, s, i);
     }
     // compute H = R + w * v^T
     // Since w = +-||w|| * e_1, this amounts to adding w[0] * v^t to R.row(0)
-    for (size_type i = 0; i < num_cols(); ++i)
-      _r_begin[i][0] += w[0] * v[i];
+    for (size_type i = 0; i < k; ++i)
+      r_col(i)[0] += w[0] * v[i];
     // R is now upper Hessenberg
-    hessenberg_update(0, (is_not_square ? num_cols() : num_cols() - 1));
+    hessenberg_update(0, (extended ? k : k - 1));
+    // the additional row of R is zero again, drop the additional column of Q
+    if (extended)
+      _q.resize(k * num_rows());
   }
-  
+
    /**
     @brief finds the least-squares solution to QR * x = b
   */
@@ -186,40 +208,102 @@ public:
     assert(num_cols() > 0);
     auto & x_w = const_cast<Eigen::MatrixBase<Derived2> &>(x);
     assert(size_type(x_w.rows()) == num_cols());
-    eigen_vector u = _q.transpose() * b;
-    // now back substitution: R * x = u
+    // x = Q^T * b, computed column by column to avoid a temporary for b
+    for (size_type i = 0; i < num_cols(); ++i)
+      x_w[i] = eigen_cmap(q_col(i), num_rows()).dot(b);
+    // now back substitution in place: R * x = Q^T * b
     for (size_type i = num_cols(); i-- > 0;) {
       for (size_type j = i + 1; j < num_cols(); ++j)
-        u[i] -= x_w[j] * _r_begin[j][i];
-      x_w[i] = u[i] / _r_begin[i][i];
+        x_w[i] -= x_w[j] * r_col(j)[i];
+      x_w[i] /= r_col(i)[i];
     }
   }
-  
-  ~dynamic_qr() {
-    DLOG(INFO) << "**QR-DESTRUCT " << this << std::endl;
-    if (_r_begin) {
-      delete[] _r_begin;
-      _r_begin = nullptr;
+
+  /**
+    @brief a componentwise bound on the rounding error of x = solve(b), for
+           a right-hand side b that is known up to b_err: |x - x*| <= err,
+           where x* solves Q * R * x* = b* exactly for every |b* - b| <=
+           b_err, to first order in the unit roundoff. It covers Q^T * b
+           and the back substitution (Higham, Thm. 8.5), with |R^-1|
+           bounded by the inverse of the comparison matrix of R (Thm.
+           8.12), at the cost of solve(). The error of the factorization
+           itself, i.e. of Q * R against the matrix it was built from, is
+           not covered.
+  */
+  template <typename Derived1, typename Derived2, typename Derived3,
+            typename Derived4>
+  void solve_error(Eigen::MatrixBase<Derived1> const& b,
+                   Eigen::MatrixBase<Derived2> const& b_err,
+                   Eigen::MatrixBase<Derived3> const& x,
+                   Eigen::MatrixBase<Derived4> const& err) const {
+    using std::abs;
+    assert(num_cols() > 0);
+    auto & err_w = const_cast<Eigen::MatrixBase<Derived4> &>(err);
+    assert(size_type(err_w.rows()) == num_cols());
+    size_type const k = num_cols();
+    number_type const gamma_d = error_factor<number_type>(num_rows());
+    number_type const gamma_k = error_factor<number_type>(k + 1);
+    // the perturbation of Q^T * b and of R, times x
+    for (size_type i = 0; i < k; ++i) {
+      number_type t_i = 0;
+      for (size_type j = 0; j < num_rows(); ++j)
+        t_i += abs(q_col(i)[j]) * (gamma_d * abs(b[j]) + b_err[j]);
+      for (size_type j = i; j < k; ++j)
+        t_i += gamma_k * abs(r_col(j)[i]) * abs(x[j]);
+      err_w[i] = t_i;
     }
-    if (_r_raw) {      
-      delete[] _r_raw;
-      _r_raw = nullptr;
+    // times the inverse of the comparison matrix, which is not negative
+    for (size_type i = k; i-- > 0;) {
+      for (size_type j = i + 1; j < k; ++j)
+        err_w[i] += abs(r_col(j)[i]) * err_w[j];
+      err_w[i] /= abs(r_col(i)[i]);
     }
+    // the rounding of the bound itself
+    err_w *= 1 + error_factor<number_type>(2 * k + num_rows());
+  }
+
+  ~dynamic_qr() {
+    DLOG(INFO) << "**QR-DESTRUCT " << this << std::endl;
   }
 
 private:
+  // column j of Q, respectively R, both stored with leading dimension
+  // num_rows(), which leaves room for the sub-diagonal of R during updates
+  number_type * q_col(size_type j) {
+    return _q.data() + j * num_rows();
+  }
+
+  number_type const* q_col(size_type j) const {
+    return _q.data() + j * num_rows();
+  }
+
+  number_type * r_col(size_type j) {
+    return _r.data() + j * num_rows();
+  }
+
+  number_type const* r_col(size_type j) const {
+    return _r.data() + j * num_rows();
+  }
+
   /**
-    @brief helper function to avoid code duplication in constructors
-    @param begin iterator to the offsets of the columns into the raw pointer
+    @brief sets column j of Q to a unit vector orthogonal to the columns
+           0, ..., j - 1
   */
-  template <class Iterator>
-  void init_row_ptr(Iterator begin) {
-    size_type const max_cols = _q.cols();
-    auto const& num_rows = max_cols;
-    assert(nullptr != _r_raw);  // to make sure constructors initialized
-                                // the storage
-    for (size_type i = 0; i < max_cols; ++i)
-      _r_begin[i] = _r_raw + *(begin++) * num_rows;
+  void complete_basis(size_type j) {
+    eigen_map q(q_col(j), num_rows());
+    eigen_mat_cmap const q_old(_q.data(), num_rows(), j);
+    // the unit vector with the smallest component in the span of Q
+    typename eigen_mat::Index min_row = 0;
+    if (j > 0)
+      q_old.rowwise().squaredNorm().minCoeff(&min_row);
+    q.setZero();
+    q[min_row] = 1;
+    for (int pass = 0; pass < 2; ++pass) {
+      for (size_type i = 0; i < j; ++i)
+        q -= eigen_cmap(q_col(i), num_rows()).dot(q) *
+             eigen_cmap(q_col(i), num_rows());
+    }
+    q.normalize();
   }
 
   void givens(number_type const& a, number_type const& b,
@@ -241,19 +325,21 @@ private:
     DCHECK(abs(*c) <= 1);
     DCHECK(abs(*s) <= 1);
   }
-  
+
   void update_q(number_type const& c, number_type const& s, size_type k) {
     assert(0 <= k);
-    assert(typename eigen_mat::Index(k + 1) < _q.cols());
+    assert((k + 2) * num_rows() <= _q.size());
 
-    number_type tmp;    
-    for (typename eigen_mat::Index i = 0; i < _q.cols(); ++i) {
-      tmp = c * _q(i, k) - s * _q(i, k + 1);
-      _q(i, k + 1) = s * _q(i, k) + c * _q(i, k + 1);
-      _q(i, k) = tmp;
+    number_type tmp;
+    number_type * q_k = q_col(k);
+    number_type * q_k1 = q_col(k + 1);
+    for (size_type i = 0; i < num_rows(); ++i) {
+      tmp = c * q_k[i] - s * q_k1[i];
+      q_k1[i] = s * q_k[i] + c * q_k1[i];
+      q_k[i] = tmp;
     }
   }
-  
+
   void apply_half_givens(number_type const& c, number_type const& s,
                          number_type * col, size_type a_idx) {
     assert(col);
@@ -262,31 +348,30 @@ private:
 
     col[a_idx] = c * col[a_idx] - s * col[a_idx + 1];
   }
-  
+
   void apply_givens(number_type const& c, number_type const& s,
                     size_type r_col_begin, size_type a_idx) {
     assert(0 <= r_col_begin);
-    assert(r_col_begin <= num_cols());
     assert(0 <= a_idx);
     assert(a_idx < num_rows() - 1);
 
     number_type tmp;
     for (size_type j = r_col_begin; j < num_cols(); ++j) {
-      tmp = c * _r_begin[j][a_idx] - s * _r_begin[j][a_idx + 1];
-      _r_begin[j][a_idx + 1] = s * _r_begin[j][a_idx] +
-                               c * _r_begin[j][a_idx + 1];
-      _r_begin[j][a_idx] = tmp;
+      number_type * r_j = r_col(j);
+      tmp = c * r_j[a_idx] - s * r_j[a_idx + 1];
+      r_j[a_idx + 1] = s * r_j[a_idx] + c * r_j[a_idx + 1];
+      r_j[a_idx] = tmp;
     };
   }
-  
+
   /**
     @param col_end the index of the column past the last column to update
   */
   void hessenberg_update(size_type k, size_type col_end) {
     number_type c, s;
     for (size_type i = k; i < col_end; ++i) {
-      givens(_r_begin[i][i], _r_begin[i][i + 1], &c, &s);
-      apply_half_givens(c, s, _r_begin[i], i);
+      givens(r_col(i)[i], r_col(i)[i + 1], &c, &s);
+      apply_half_givens(c, s, r_col(i), i);
       apply_givens(c, s, i + 1, i);
       update_q(c, s, i);
     }
@@ -295,24 +380,29 @@ private:
   template <typename _nr_type>
   friend std::ostream & operator<<(std::ostream &, dynamic_qr<_nr_type> const&);
 
-  eigen_mat   _q;
-  number_type *  _r_raw;
-  number_type ** _r_begin;
-  number_type ** _r_end;
+  size_type                _num_rows;
+  size_type                _num_cols;
+  std::vector<number_type>        _q;
+  std::vector<number_type>        _r;
 };
 
 template <typename number_type>
 std::ostream & operator<<(std::ostream & ostr,
                           dynamic_qr<number_type> const& dqr) {
   using size_type = typename dynamic_qr<number_type>::size_type;
-  ostr << "Q = \n" << dqr._q << '\n';
-  ostr << "R = \n";
+  ostr << "Q = \n";
   for (size_type i = 0; i < dqr.num_rows(); ++i) {
+    for (size_type j = 0; j < dqr.num_cols(); ++j)
+      ostr << dqr.q_col(j)[i] << '\t';
+    ostr << '\n';
+  }
+  ostr << "R = \n";
+  for (size_type i = 0; i < dqr.num_cols(); ++i) {
     for (size_type j = 0; j < dqr.num_cols(); ++j) {
       if (i > j)
         ostr << 0 << '\t';
       else
-        ostr << dqr._r_begin[j][i] << '\t';
+        ostr << dqr.r_col(j)[i] << '\t';
     }
     ostr << '\n';
   }
@@ -322,4 +412,3 @@ std::ostream & operator<<(std::ostream & ostr,
 }  // namespace FC
 
 #endif  // DYNAMIC_QR_HPP_
-
@@ -0,0 +1,58 @@
+// C headers
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+
+// C++ headers
+#include <array>
+#include <iostream>
+#include <map>
+
+#define EIGEN_DONT_VECTORIZE
+
+// 3rd-party library headers
+#include <Eigen/Core>
+
+// local headers
+#include "async.hpp"
+
+/**
+  @brief This example demonstrates the asynchronous computation, which
+         builds a histogram of the critical points while they are found.
+*/
+int main(int, char**) {
+  using size_type = std::uint32_t;
+  size_type constexpr NUM_PTS  =     200;
+  size_type constexpr DIM      =       3;
+  // create random point cloud
+  using eigen_matrix = Eigen::MatrixXd;
+  using float_t = Eigen::MatrixXd::Scalar;
+  std::srand(std::time(nullptr));
+  eigen_matrix const point_storage = eigen_matrix::Random(DIM, NUM_PTS);
+  std::array<float_t const*, NUM_PTS> points;
+  for (size_type i = 0; i < NUM_PTS; ++i)
+    points[i] = point_storage.col(i).data();
+  // the callbacks run one at a time, hence the histogram needs no lock
+  using cp_type = FC::critical_point<float_t, size_type>;
+  std::map<size_type, std::size_t> hist;
+  std::size_t num_incidences = 0;
+  FC::stream_callbacks<cp_type> callbacks;
+  callbacks.on_critical_point = [&] (cp_type const& cp) {++hist[cp.index()];};
+  callbacks.on_incidence = [&] (cp_type const&, cp_type const&) {
+    ++num_incidences;
+  };
+  auto result = FC::compute_flow_complex_async<size_type>(
+      points.cbegin(), points.cend(), DIM, FC::compute_options(), callbacks);
+  auto fc = result.get();
+
+  // the minima are not streamed
+  hist[0] = NUM_PTS;
+  for (auto const& el : hist)
+    std::cout << el.first << "\t" << el.second << "\n";
+  std::cout << num_incidences << " incidences\n";
+  if (not FC::validate(fc)) {
+    std::cerr << "flow complex validation failed\n";
+    std::exit(EXIT_FAILURE);
+  }
+  std::exit(EXIT_SUCCESS);
+}
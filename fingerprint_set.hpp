@@ -0,0 +1,229 @@
+#ifndef FINGERPRINT_SET_HPP_
+#define FINGERPRINT_SET_HPP_
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <tbb/spin_mutex.h>
+
+#include "random.hpp"
+#include "utility.hpp"
+
+namespace FC {
+
+/**
+  @brief memory statistics of a fingerprint_set
+*/
+struct fingerprint_set_statistics {
+  std::size_t size = 0;
+  // the number of keys in the exact fallback buckets
+  std::size_t collisions = 0;
+  std::size_t bytes = 0;
+
+  fingerprint_set_statistics & operator+=(fingerprint_set_statistics const& rhs) {
+    size += rhs.size;
+    collisions += rhs.collisions;
+    bytes += rhs.bytes;
+    return *this;
+  }
+};
+
+template <typename OStream>
+OStream & operator<<(OStream & os, fingerprint_set_statistics const& stats) {
+  os << "dedup sets: " << stats.size << " entries, " << stats.collisions
+     << " in exact fallback buckets (~" << stats.bytes / 1024 << " KiB)";
+  return os;
+}
+
+/**
+  @brief A compact concurrent set of sorted index sets, e.g. the supports of
+         circumspheres, that only answers whether an index set was inserted
+         before. Instead of the indices, it stores a 128 bit fingerprint per
+         entry in open-addressing tables, which are split into shards that
+         are guarded by spin mutexes.
+         Two index sets whose fingerprints agree in the 64 bits that locate
+         the slot, but not in the others, are told apart exactly: the later
+         ones are kept with all their indices in a fallback bucket of the
+         shard. Only index sets with equal 128 bit fingerprints are
+         mistaken for each other.
+*/
+template <typename _size_type>
+class fingerprint_set {
+public:
+  typedef _size_type             size_type;
+  typedef std::vector<size_type> key_type;
+
+private:
+  struct fingerprint {
+    std::uint64_t slot;  // 0 marks an empty slot
+    std::uint64_t check;
+  };
+
+  struct KeyHash {
+    std::size_t operator()(key_type const& key) const {
+      return RangeHash()(key.begin(), key.end());
+    }
+  };
+
+  struct shard {
+    shard() : mutex(), slots(), size(0), fallback() {
+    }
+
+    tbb::spin_mutex                       mutex;
+    // empty or a power of 2 size, allocated with the first entry
+    std::vector<fingerprint>              slots;
+    std::size_t                           size;
+    std::unordered_set<key_type, KeyHash> fallback;
+  };
+
+public:
+  explicit fingerprint_set(std::size_t num_shards = 16)
+    : _shards(std::max<std::size_t>(1, num_shards)) {
+  }
+
+  fingerprint_set(fingerprint_set const&) = delete;
+  fingerprint_set & operator=(fingerprint_set const&) = delete;
+
+  /**
+    @param begin, end a sorted range of indices
+    @return true if the index set was not in the set before
+  */
+  template <class Iterator>
+  bool insert(Iterator begin, Iterator end) {
+    assert(std::is_sorted(begin, end));
+    fingerprint const fp = make_fingerprint(begin, end);
+    auto & s = _shards[fp.check % _shards.size()];
+    tbb::spin_mutex::scoped_lock lock(s.mutex);
+    if (s.slots.empty())
+      s.slots.assign(initial_capacity, fingerprint{0, 0});
+    std::size_t const mask = s.slots.size() - 1;
+    std::size_t pos = fp.slot & mask;
+    for (; 0 != s.slots[pos].slot; pos = (pos + 1) & mask) {
+      if (s.slots[pos].slot == fp.slot) {
+        if (s.slots[pos].check == fp.check)
+          return false;
+        return s.fallback.emplace(begin, end).second;
+      }
+    }
+    s.slots[pos] = fp;
+    // keep the load factor at most 3/4
+    if (4 * ++s.size > 3 * s.slots.size())
+      grow(s);
+    return true;
+  }
+
+  fingerprint_set_statistics statistics() {
+    fingerprint_set_statistics r;
+    for (auto & s : _shards) {
+      tbb::spin_mutex::scoped_lock lock(s.mutex);
+      r.size += s.size + s.fallback.size();
+      r.collisions += s.fallback.size();
+      r.bytes += sizeof(shard) + s.slots.capacity() * sizeof(fingerprint);
+      for (auto const& key : s.fallback)
+        // the node, its bucket and the indices
+        r.bytes += sizeof(key_type) + 2 * sizeof(void*) +
+                   key.capacity() * sizeof(size_type);
+    }
+    return r;
+  }
+
+  /**
+    @brief writes the fingerprints and the fallback buckets to os. Must not
+           run concurrently with insert().
+  */
+  void save(std::ostream & os) const {
+    for (auto const& s : _shards) {
+      os << s.size << ' ' << s.fallback.size() << '\n';
+      for (auto const& fp : s.slots)
+        if (0 != fp.slot)
+          os << fp.slot << ' ' << fp.check << '\n';
+      for (auto const& key : s.fallback) {
+        save_range(os, key.begin(), key.end());
+        os << '\n';
+      }
+    }
+    os << "end\n";
+  }
+
+  /**
+    @brief adds the entries written by save() to the set, which may have a
+           different number of shards
+  */
+  void load(std::istream & is) {
+    std::string token;
+    while (is >> token && "end" != token) {
+      std::size_t const num_fps = std::stoull(token);
+      std::size_t num_fallback = 0;
+      is >> num_fallback;
+      for (std::size_t i = 0; i < num_fps; ++i) {
+        fingerprint fp{0, 0};
+        is >> fp.slot >> fp.check;
+        auto & s = _shards[fp.check % _shards.size()];
+        insert_fingerprint(s, fp);
+      }
+      key_type key;
+      for (std::size_t i = 0; i < num_fallback; ++i) {
+        load_range(is, key);
+        insert(key.begin(), key.end());
+      }
+    }
+  }
+
+private:
+  static constexpr std::size_t initial_capacity = 8;
+
+  // inserts fp into s, which is not locked
+  static void insert_fingerprint(shard & s, fingerprint fp) {
+    if (s.slots.empty())
+      s.slots.assign(initial_capacity, fingerprint{0, 0});
+    std::size_t const mask = s.slots.size() - 1;
+    std::size_t pos = fp.slot & mask;
+    for (; 0 != s.slots[pos].slot; pos = (pos + 1) & mask)
+      if (s.slots[pos].slot == fp.slot && s.slots[pos].check == fp.check)
+        return;
+    s.slots[pos] = fp;
+    if (4 * ++s.size > 3 * s.slots.size())
+      grow(s);
+  }
+
+  template <class Iterator>
+  static fingerprint make_fingerprint(Iterator begin, Iterator end) {
+    // two independent hashes of the indices, seeded differently
+    std::uint64_t h1 = 0x243f6a8885a308d3ULL;
+    std::uint64_t h2 = 0x13198a2e03707344ULL;
+    for (; begin != end; ++begin) {
+      std::uint64_t const idx = static_cast<std::uint64_t>(*begin);
+      h1 = mix64(h1 ^ idx);
+      h2 = mix64(h2 + idx * 0x9e3779b97f4a7c15ULL);
+    }
+    return fingerprint{0 != h1 ? h1 : 1, h2};
+  }
+
+  static void grow(shard & s) {
+    std::vector<fingerprint> slots(2 * s.slots.size(), fingerprint{0, 0});
+    std::size_t const mask = slots.size() - 1;
+    for (auto const& fp : s.slots) {
+      if (0 == fp.slot)
+        continue;
+      std::size_t pos = fp.slot & mask;
+      while (0 != slots[pos].slot)
+        pos = (pos + 1) & mask;
+      slots[pos] = fp;
+    }
+    s.slots.swap(slots);
+  }
+
+  std::vector<shard> _shards;
+};
+
+}  // namespace FC
+
+#endif  // FINGERPRINT_SET_HPP_
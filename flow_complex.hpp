@@ -2,21 +2,27 @@
 #define FLOW_COMPLEX_HPP_
 
 #include <cmath>
+#include <cstddef>
 
 #include <algorithm>
+#include <functional>
+#include <memory>
 #include <utility>
 #include <map>
+#include <unordered_map>
 #include <ostream>
 #include <istream>
 #include <string>
 #include <sstream>
 #include <iomanip>
 #include <limits>
+#include <vector>
 
 #include <glog/logging.h>
 #include <tbb/concurrent_unordered_set.h>
 
 #include "critical_point.hpp"
+#include "metrics.hpp"
 
 namespace FC {
 
@@ -38,21 +44,29 @@ using self_t = flow_complex<_number_type, _size_type>;
   public:
     typedef typename cp_container::iterator             iterator;
     typedef typename cp_container::const_iterator const_iterator;
+    typedef std::function<void(cp_type const&, cp_type const*)> observer_type;
   
     /**
       @brief initializes the flow complex with a maximum at infinity
     */
     flow_complex(size_type dim, size_type num_pts)
-    : _minima(num_pts, nullptr) {
+    : _max_at_cutoff(new cp_type(dim, true)), _minima(num_pts, nullptr),
+      _sq_radius_cutoff(std::numeric_limits<number_type>::infinity()),
+      _num_pending_tasks(0) {
       _max_at_inf = &*_cps.insert(cp_type(dim)).first;
       // init fc with id-0 critical points
       for (size_type i = 0; i < num_pts; ++i)
-        _minima[i] = insert(cp_type(&i, &i + 1, 0)).second;
+        _minima[i] = &*_cps.insert(cp_type(&i, &i + 1, 0)).first;
     }
     // copy- and move-constructor
     flow_complex(flow_complex const&) = delete;
     flow_complex(flow_complex && tmp)
-    : _max_at_inf(tmp._max_at_inf), _cps(), _minima(std::move(tmp._minima)) {
+    : _max_at_inf(tmp._max_at_inf),
+      _max_at_cutoff(std::move(tmp._max_at_cutoff)), _cps(),
+      _minima(std::move(tmp._minima)),
+      _sq_radius_cutoff(tmp._sq_radius_cutoff),
+      _num_pending_tasks(tmp._num_pending_tasks),
+      _observer(std::move(tmp._observer)) {
       DLOG(INFO) << "FC-MOVE-CTOR\n";
       _cps.swap(tmp._cps);
     }
@@ -61,8 +75,12 @@ using self_t = flow_complex<_number_type, _size_type>;
     flow_complex & operator=(flow_complex && rhs) {
       if (this != &rhs) {
         _max_at_inf = rhs._max_at_inf;
+        _max_at_cutoff = std::move(rhs._max_at_cutoff);
         _cps.swap(rhs._cps);
         _minima = std::move(rhs._minima);
+        _sq_radius_cutoff = rhs._sq_radius_cutoff;
+        _num_pending_tasks = rhs._num_pending_tasks;
+        _observer = std::move(rhs._observer);
       }
       return *this;
     }
@@ -90,7 +108,10 @@ using self_t = flow_complex<_number_type, _size_type>;
     }
     
     // modifiers
+    // an erased minimum is null from then on, see minimum()
     bool erase(cp_type const& cp) {
+      if (!cp.is_max_at_inf() && 0 == cp.index())
+        _minima[*cp.idx_begin()] = nullptr;
       return _cps.unsafe_erase(cp);
     }
     void erase(iterator);
@@ -105,17 +126,46 @@ using self_t = flow_complex<_number_type, _size_type>;
       auto ret_pair = _cps.insert(cp);
       r.first =   ret_pair.second;
       r.second = &*ret_pair.first;
-      if (r.first)
+      if (r.first) {
         DLOG(INFO) << "CRITICAL POINT IS NEW!\n";
-      else
+        metrics::add(metric::new_critical_points);
+        if (_observer) {
+          // the successors of the argument are the ones at the insertion,
+          // the inserted one may gain more concurrently
+          _observer(*r.second, nullptr);
+          for (auto it = cp.succ_begin(); it != cp.succ_end(); ++it)
+            _observer(*r.second, *it);
+        }
+      } else {
         DLOG(INFO) << "CRITICAL POINT WAS FOUND ALREADY\n";
+        metrics::add(metric::found_critical_points);
+      }
       return r;
     }
     
+    /**
+      @brief adds succ to the successors of cp, and reports it to the
+             observer if it is new
+    */
+    void add_incidence(cp_type * cp, cp_type * succ) const {
+      if (cp->add_successor(succ) && _observer)
+        _observer(*cp, succ);
+    }
+    
     cp_type * max_at_inf() const {
       return _max_at_inf;
     }
     
+    /**
+      @brief the successor of the critical points whose flow was cut off at
+             sq_radius_cutoff(), instead of the maximum at infinity. It is
+             not one of the critical points of the flow complex, hence it is
+             not iterated over and not counted by validate().
+    */
+    cp_type * max_at_cutoff() const {
+      return _max_at_cutoff.get();
+    }
+    
     cp_type * minimum(size_type pos) const {
       return _minima[pos];
     }
@@ -128,10 +178,62 @@ using self_t = flow_complex<_number_type, _size_type>;
       auto it = _cps.find(cp);
       return (it == _cps.end() ? nullptr : &*it);
     }
+    
+    /**
+      @brief the squared radius beyond which the flow is not followed, see
+             compute_options::r_max. max_at_cutoff() then stands for all
+             critical points beyond it. Infinite by default.
+    */
+    number_type sq_radius_cutoff() const {
+      return _sq_radius_cutoff;
+    }
+    
+    void set_sq_radius_cutoff(number_type sq_radius) {
+      _sq_radius_cutoff = sq_radius;
+    }
+    
+    /**
+      @brief the number of tasks that were discarded since the computation
+             was cancelled (see compute_options::cancel). The points whose
+             Gabriel edges were not searched count as a task each, and so
+             does the cleaning of the incidences of a region. If not 0,
+             critical points and incidences are missing, or redundant
+             incidences are kept.
+    */
+    std::size_t num_pending_tasks() const {
+      return _num_pending_tasks;
+    }
+    
+    void set_num_pending_tasks(std::size_t num_tasks) {
+      _num_pending_tasks = num_tasks;
+    }
+    
+    bool is_complete() const {
+      return 0 == _num_pending_tasks;
+    }
+    
+    /**
+      @brief observer(cp, nullptr) is called when cp is inserted, and
+             observer(cp, succ) when succ becomes a successor of cp, by
+             insert() and add_incidence(). It is called on the thread that
+             made the change, possibly by several threads at once, and it
+             must not modify the flow complex.
+    */
+    void set_observer(observer_type observer) {
+      _observer = std::move(observer);
+    }
+
+    observer_type const& observer() const {
+      return _observer;
+    }
 private:
   cp_type *              _max_at_inf;
+  std::unique_ptr<cp_type> _max_at_cutoff;
   cp_container                  _cps;
   std::vector<cp_type *>     _minima;
+  number_type      _sq_radius_cutoff;
+  std::size_t     _num_pending_tasks;
+  observer_type            _observer;
     
   template <typename nt, typename st>
   friend std::istream & operator>>(std::istream &, flow_complex<nt, st> &);
@@ -150,33 +252,164 @@ std::map<st, int> compute_hist(flow_complex<nt, st> const& fc) {
   return hist;
 }
 
-template <typename number_type, typename size_type>
-bool validate(flow_complex<number_type, size_type> const& fc) {
-  auto hist = compute_hist(fc);
+/**
+  @return whether the Euler characteristic of the histogram of the critical
+          points (see compute_hist) is 1
+*/
+template <typename st>
+bool validate(std::map<st, int> const& hist) {
   int sum = 0;
   for (auto const& el : hist)
     sum += (0 == (el.first % 2) ? el.second : -el.second);
   return 1 == sum;
 }
 
+template <typename number_type, typename size_type>
+bool validate(flow_complex<number_type, size_type> const& fc) {
+  return validate(compute_hist(fc));
+}
+
+/**
+  @brief removes the critical points for which remove(cp) is true, and the
+         incidences with them. The maximum at infinity is kept, but loses its
+         incidences if remove holds for it.
+*/
+template <typename nt, typename st, class Predicate>
+void erase_if(flow_complex<nt, st> & fc, Predicate remove) {
+  using cp_type = typename flow_complex<nt, st>::cp_type;
+  std::vector<cp_type const*> removed_succs;
+  std::vector<std::vector<st>> removed;
+  for (auto & cp : fc) {
+    removed_succs.clear();
+    for (auto it = cp.succ_begin(); it != cp.succ_end(); ++it)
+      if (remove(**it))
+        removed_succs.push_back(*it);
+    for (auto const* succ : removed_succs)
+      cp.erase(succ);
+    if (!cp.is_max_at_inf() && remove(cp))
+      removed.emplace_back(cp.idx_begin(), cp.idx_end());
+  }
+  for (auto const& idx : removed)
+    fc.erase(cp_type(idx.begin(), idx.end(), 0));
+}
 
+/**
+  @brief removes the critical points of index greater than max_index, and the
+         incidences with them. The maximum at infinity, whose index is the
+         dimension, is kept.
+*/
 template <typename nt, typename st>
-std::ostream & operator<<(std::ostream & os, flow_complex<nt, st> const& fc) {
-  using out_nt = long double;
+void truncate(flow_complex<nt, st> & fc, st max_index) {
+  using cp_type = typename flow_complex<nt, st>::cp_type;
+  erase_if(fc, [max_index] (cp_type const& cp) {
+    return cp.index() > max_index;
+  });
+}
+
+/**
+  @brief renames the points of fc: the point i becomes new_index[i]
+  @return the flow complex of num_points points, with the same incidences
+*/
+template <typename nt, typename st>
+flow_complex<nt, st> relabel(flow_complex<nt, st> const& fc,
+                             std::vector<st> const& new_index, st num_points) {
+  using fc_type = flow_complex<nt, st>;
+  using cp_type = typename fc_type::cp_type;
+  fc_type result(fc.max_at_inf()->index(), num_points);
+  result.set_sq_radius_cutoff(fc.sq_radius_cutoff());
+  result.set_num_pending_tasks(fc.num_pending_tasks());
+  std::unordered_map<cp_type const*, cp_type *> image;
+  image.emplace(fc.max_at_inf(), result.max_at_inf());
+  image.emplace(fc.max_at_cutoff(), result.max_at_cutoff());
+  std::vector<st> idx;
   for (auto const& cp : fc) {
-    if (cp.is_max_at_inf()) {
-      os << cp << cp.index() << std::endl;
-    } else {
-      os << cp;
-      os << "| ";
-      os << std::setprecision(std::numeric_limits<out_nt>::digits10)
-         << out_nt(sqrt(cp.sq_dist()));
-      os << " ";
-      for (auto it = cp.succ_begin(); it != cp.succ_end(); ++it)
-        os << "| " << **it;
-      os << std::endl;
-    }
+    if (cp.is_max_at_inf())
+      continue;
+    idx.clear();
+    for (auto it = cp.idx_begin(); it != cp.idx_end(); ++it)
+      idx.push_back(new_index[*it]);
+    image.emplace(&cp, 0 == cp.index()
+        ? result.minimum(idx.front())
+        : result.insert(cp_type(idx.begin(), idx.end(), cp.sq_dist())).second);
   }
+  for (auto const& el : image)
+    for (auto it = el.first->succ_begin(); it != el.first->succ_end(); ++it)
+      el.second->add_successor(image.at(*it));
+  return result;
+}
+
+/**
+  @brief writes the line of a critical point other than the maximum at
+         infinity, see operator<<
+*/
+template <typename nt, typename st>
+void write_line(std::ostream & os, critical_point<nt, st> const& cp) {
+  using out_nt = long double;
+  os << cp;
+  os << "| ";
+  os << std::setprecision(std::numeric_limits<out_nt>::digits10)
+     << out_nt(sqrt(cp.sq_dist()));
+  os << " ";
+  for (auto it = cp.succ_begin(); it != cp.succ_end(); ++it)
+    os << "| " << **it;
+  os << std::endl;
+}
+
+/**
+  @brief writes the "cutoff" line, if any, the one of the maximum at
+         infinity, and the "incomplete" line, if any, see operator<<
+*/
+template <typename nt, typename st>
+void write_header(std::ostream & os, flow_complex<nt, st> const& fc) {
+  using out_nt = long double;
+  if (!std::isinf(fc.sq_radius_cutoff()))
+    os << *fc.max_at_cutoff()
+       << std::setprecision(std::numeric_limits<out_nt>::digits10)
+       << out_nt(sqrt(fc.sq_radius_cutoff())) << std::endl;
+  os << *fc.max_at_inf() << fc.max_at_inf()->index() << std::endl;
+  if (!fc.is_complete())
+    os << "incomplete " << fc.num_pending_tasks() << std::endl;
+}
+
+/**
+  @brief writes a line per critical point: its indices, its distance and
+         its successors, separated by '|'. The maximum at infinity is "inf",
+         and if the flow was followed up to a radius only, the line
+         "cutoff <radius>" precedes them and the successor "cutoff" stands
+         for the flows that were cut off. If the computation was stopped, the
+         line "incomplete <number of pending tasks>" follows the one of the
+         maximum at infinity.
+*/
+template <typename nt, typename st>
+std::ostream & operator<<(std::ostream & os, flow_complex<nt, st> const& fc) {
+  write_header(os, fc);
+  for (auto const& cp : fc)
+    if (!cp.is_max_at_inf())
+      write_line(os, cp);
+  return os;
+}
+
+/**
+  @brief like operator<<, but lists the critical points in the
+         lexicographic order of their indices, such that files written this
+         way can be merged line by line
+*/
+template <typename nt, typename st>
+std::ostream & write_sorted(std::ostream & os,
+                            flow_complex<nt, st> const& fc) {
+  using cp_type = typename flow_complex<nt, st>::cp_type;
+  std::vector<cp_type const*> cps;
+  cps.reserve(fc.size());
+  for (auto const& cp : fc)
+    if (!cp.is_max_at_inf())
+      cps.push_back(&cp);
+  std::sort(cps.begin(), cps.end(), [] (cp_type const* a, cp_type const* b) {
+    return std::lexicographical_compare(a->idx_begin(), a->idx_end(),
+                                        b->idx_begin(), b->idx_end());
+  });
+  write_header(os, fc);
+  for (auto const* cp : cps)
+    write_line(os, *cp);
   return os;
 }
 
@@ -192,6 +425,8 @@ std::istream & operator>>(std::istream & is,
   fc._cps.clear();
   fc._max_at_inf = nullptr;
   fc._minima.clear();
+  fc._sq_radius_cutoff = std::numeric_limits<float_t>::infinity();
+  fc._num_pending_tasks = 0;
   // "global" variables for lambdas
   std::string line;
   std::vector<st> idxvec;
@@ -199,11 +434,20 @@ std::istream & operator>>(std::istream & is,
   auto const WS = " \t";  // WHITESPACE
   auto const DELIM = '|';
   // helper lambdas
-  auto is_inf_line = [WS] (std::string const& s, size_type start = 0) {
+  auto first_word = [WS] (std::string const& s, size_type start = 0) {
     size_type pos1 = s.find_first_not_of(WS, start);
     size_type pos2 = s.find_first_of(WS, pos1);
     pos2 = (pos2 == std::string::npos) ? pos2 : pos2 - pos1;
-    return s.substr(pos1, pos2) == "inf";
+    return s.substr(pos1, pos2);
+  };
+  auto is_inf_line = [&] (std::string const& s, size_type start = 0) {
+    return first_word(s, start) == "inf";
+  };
+  auto is_cutoff_line = [&] (std::string const& s, size_type start = 0) {
+    return first_word(s, start) == "cutoff";
+  };
+  auto is_incomplete_line = [&] (std::string const& s) {
+    return first_word(s) == "incomplete";
   };
   auto check_pos = [] (std::size_t pos) {
     if (pos == std::string::npos) throw std::invalid_argument("parse error");
@@ -211,7 +455,7 @@ std::istream & operator>>(std::istream & is,
   auto parse_indices = [&] (std::string const& s, size_type start) {
     idxvec.clear();
     size_type end = s.find_first_of(DELIM, start);
-    if (!is_inf_line(s, start)) {
+    if (!is_inf_line(s, start) && !is_cutoff_line(s, start)) {
       std::istringstream is(s.substr(start, end - start));
       st tmp;
       while (is >> tmp)
@@ -239,6 +483,23 @@ std::istream & operator>>(std::istream & is,
       st dim;
       dim_stream >> dim;
       fc._max_at_inf = fc.insert(cp_type(dim)).second;
+      // keeps the cut off flows read so far pointing to it
+      if (fc._max_at_cutoff)
+        fc._max_at_cutoff->_index = dim;
+      else
+        fc._max_at_cutoff.reset(new cp_type(dim, true));
+    } else if (is_cutoff_line(line)) {  // parse the radius cutoff
+      std::istringstream radius_stream(
+          line.substr(line.find_first_not_of(WS) + 6));
+      float_t radius;
+      if (!(radius_stream >> radius))
+        throw std::invalid_argument("parse error");
+      fc._sq_radius_cutoff = radius * radius;
+    } else if (is_incomplete_line(line)) {  // parse the pending tasks
+      std::istringstream pending_stream(
+          line.substr(line.find_first_not_of(WS) + 10));
+      if (!(pending_stream >> fc._num_pending_tasks))
+        throw std::invalid_argument("parse error");
     } else {  // parse regular cps
       size_type start = 0;
       // parse indices of cp itself
@@ -258,8 +519,12 @@ std::istream & operator>>(std::istream & is,
       cp_ptr->_sq_dist = dist * dist;  // even if the insert was new
       // parse succsessors
       while (std::string::npos != start) {
-        start = parse_indices(line, ++start);
-        if (idxvec.empty()) {  // succ is cp at inf
+        bool const cut_off = is_cutoff_line(line, ++start);
+        start = parse_indices(line, start);
+        if (cut_off) {
+          assert(fc._max_at_cutoff);
+          cp_ptr->add_successor(fc._max_at_cutoff.get());
+        } else if (idxvec.empty()) {  // succ is cp at inf
           // assumes the data format always lists the cp at inf first
           assert(fc._max_at_inf);
           cp_ptr->add_successor(fc._max_at_inf);
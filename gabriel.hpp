@@ -0,0 +1,131 @@
+#ifndef GABRIEL_HPP_
+#define GABRIEL_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Core>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include "flow_complex.hpp"
+#include "metrics.hpp"
+#include "point_cloud.hpp"
+#include "predicates.hpp"
+
+namespace FC {
+
+/**
+  @brief Inserts the critical points of index 1 into fc, along with their
+         incidences with the minima. These are the midpoints of the Gabriel
+         edges, i.e. of the edges whose diametral balls are empty, so they
+         are found without descending from the critical points of higher
+         index.
+         The Gabriel neighbors of a point p are searched in the kd-tree,
+         nearest boxes first. A Gabriel neighbor q rules out every point
+         beyond the hyperplane through q that is orthogonal to q - p, since
+         q lies within their diametral balls. Hence the far boxes are pruned
+         once the neighbors surround p, and only the remaining candidates
+         are tested for an empty diametral ball.
+  @param counts if not null, receives the counts of the hot paths
+  @param stop if set and it returns true, the remaining points are skipped
+  @return the number of points whose Gabriel edges were not searched, the
+          edges they would have inserted are missing
+*/
+template <class PointCloud>
+std::size_t insert_gabriel_edges(
+    PointCloud const& pc,
+    flow_complex<typename PointCloud::number_type,
+                 typename PointCloud::size_type> & fc,
+    metrics_counts * counts = nullptr,
+    std::function<bool()> const& stop = nullptr) {
+  using size_type = typename PointCloud::size_type;
+  using number_type = typename PointCloud::number_type;
+  using cp_type = critical_point<number_type, size_type>;
+  using eigen_vector = Eigen::Matrix<number_type, Eigen::Dynamic, 1>;
+  using std::abs;
+
+  number_type const eps = error_factor<number_type>(pc.dim() + 2);
+  std::atomic<std::size_t> num_skipped(0);
+  tbb::parallel_for(tbb::blocked_range<size_type>(0, pc.size()),
+                    [&] (tbb::blocked_range<size_type> const& r) {
+    metrics_block unused;
+    metrics::scope const counting(counts ? counts->local() : unused);
+    growing_ball_search<PointCloud> probe(pc);
+    eigen_vector center(pc.dim());
+    // the halfspaces v * x > c ruled out by the Gabriel neighbors found so far
+    struct halfspace {
+      eigen_vector v;
+      number_type  c;
+      number_type  c_err;
+    };
+    std::vector<halfspace> ruled_out;
+    using queue_item = std::pair<number_type, size_type>;
+    std::priority_queue<queue_item, std::vector<queue_item>,
+                        std::greater<queue_item>> nodes;
+    for (size_type i = r.begin(); i != r.end(); ++i) {
+      if (stop && stop()) {
+        num_skipped.fetch_add(r.end() - i, std::memory_order_relaxed);
+        return;
+      }
+      auto const& p = pc[i];
+      ruled_out.clear();
+      auto const is_ruled_out = [&] (size_type j) {
+        return ruled_out.end() != std::find_if(ruled_out.begin(),
+                                               ruled_out.end(),
+          [&] (halfspace const& h) {
+            return h.v.dot(pc[j]) > h.c + h.c_err;
+          });
+      };
+      nodes.emplace(number_type(0), size_type(0));
+      while (!nodes.empty()) {
+        size_type const node_idx = nodes.top().second;
+        nodes.pop();
+        if (ruled_out.end() != std::find_if(ruled_out.begin(),
+                                            ruled_out.end(),
+              [&] (halfspace const& h) {
+                return pc.kd_box_in_halfspace(node_idx, h.v, h.c, h.c_err);
+              }))
+          continue;
+        auto const& node = pc.kd_tree_node(node_idx);
+        if (!node.is_leaf()) {
+          nodes.emplace(pc.kd_box_sq_distance(node.child1, p), node.child1);
+          nodes.emplace(pc.kd_box_sq_distance(node.child2, p), node.child2);
+          continue;
+        }
+        for (size_type pos = node.begin; pos < node.end; ++pos) {
+          size_type const j = pc.kd_index(pos);
+          if (j == i || is_ruled_out(j))
+            continue;
+          center = number_type(0.5) * (p + pc[j]);
+          number_type const sq_radius = (p - center).squaredNorm();
+          probe.reset();
+          if (!probe.is_empty(center, sq_radius, [i, j] (size_type k) {
+                return k == i || k == j;
+              }))
+            continue;
+          eigen_vector v = pc[j] - p;
+          number_type const c = v.dot(pc[j]);
+          number_type const c_err = eps * v.cwiseAbs().dot(pc[j].cwiseAbs());
+          ruled_out.push_back(halfspace{std::move(v), c, c_err});
+          // every edge is found from both ends, the lower one inserts it
+          if (i < j && sq_radius <= fc.sq_radius_cutoff()) {
+            size_type const idx[] = {i, j};
+            auto * edge = fc.insert(cp_type(idx, idx + 2, sq_radius)).second;
+            fc.add_incidence(fc.minimum(i), edge);
+            fc.add_incidence(fc.minimum(j), edge);
+          }
+        }
+      }
+    }
+  });
+  return num_skipped.load();
+}
+
+}  // namespace FC
+
+#endif  // GABRIEL_HPP_
@@ -0,0 +1,215 @@
+#ifndef METRICS_HPP_
+#define METRICS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <tbb/enumerable_thread_specific.h>
+
+namespace FC {
+
+/**
+  @brief the counters of the hot paths of the computation, see metrics
+*/
+enum class metric : unsigned {
+  ascend_tasks,            // ascend tasks executed
+  descend_tasks,           // descend tasks executed
+  deduplicated_tasks,      // tasks not spawned since their circumsphere was
+                           // already handled
+  new_critical_points,     // critical points inserted into the flow complex
+  found_critical_points,   // critical points that were already inserted
+  nn_candidates,           // candidates seen by nearest_neighbor_along_ray
+  probe_rounds,            // rounds of the growing probe ball of vertex_filter
+  halfspace_searches,      // probes that fell back to a search of the
+                           // kd-tree for all points ahead of the ray
+  hull_appends,            // points appended to an affine hull
+  hull_drops,              // points dropped from an affine hull
+  count
+};
+
+std::size_t const num_metrics = std::size_t(metric::count);
+
+inline char const* metric_name(metric m) {
+  static char const* const names[num_metrics] = {
+    "ascend_tasks", "descend_tasks", "deduplicated_tasks",
+    "new_critical_points", "found_critical_points", "nn_candidates",
+    "probe_rounds", "halfspace_searches", "hull_appends", "hull_drops"
+  };
+  return names[std::size_t(m)];
+}
+
+/**
+  @brief the values of all counters at some moment
+*/
+struct metrics_snapshot {
+  std::array<std::uint64_t, num_metrics> values{};
+
+  std::uint64_t operator[](metric m) const {
+    return values[std::size_t(m)];
+  }
+
+  /** @return the counts between the snapshot rhs and this one */
+  metrics_snapshot operator-(metrics_snapshot const& rhs) const {
+    metrics_snapshot diff;
+    for (std::size_t i = 0; i < num_metrics; ++i)
+      diff.values[i] = values[i] - rhs.values[i];
+    return diff;
+  }
+
+  metrics_snapshot & operator+=(metrics_snapshot const& rhs) {
+    for (std::size_t i = 0; i < num_metrics; ++i)
+      values[i] += rhs.values[i];
+    return *this;
+  }
+};
+
+template <typename OStream>
+OStream & operator<<(OStream & os, metrics_snapshot const& snapshot) {
+  os << "counters:";
+  for (std::size_t i = 0; i < num_metrics; ++i)
+    os << (i ? ", " : " ") << metric_name(metric(i)) << " = "
+       << snapshot.values[i];
+  return os;
+}
+
+/**
+  @brief the counters of one thread, which only it writes, so counting takes
+         neither locks nor atomic read-modify-writes
+*/
+struct metrics_block {
+  metrics_block() {
+    for (auto & v : values)
+      v.store(0, std::memory_order_relaxed);
+  }
+
+  metrics_block(metrics_block const& other) {
+    for (std::size_t i = 0; i < num_metrics; ++i)
+      values[i].store(other.values[i].load(std::memory_order_relaxed),
+                      std::memory_order_relaxed);
+  }
+
+  std::array<std::atomic<std::uint64_t>, num_metrics> values;
+};
+
+/**
+  @brief the counters of one computation, a block per thread that counts
+         into it, see metrics::scope
+*/
+class metrics_counts {
+public:
+  metrics_block & local() {
+    return _blocks.local();
+  }
+
+  /** @brief must not run concurrently with counting into this */
+  metrics_snapshot snapshot() const {
+    metrics_snapshot sum;
+    for (auto const& b : _blocks)
+      for (std::size_t i = 0; i < num_metrics; ++i)
+        sum.values[i] += b.values[i].load(std::memory_order_relaxed);
+    return sum;
+  }
+
+private:
+  tbb::enumerable_thread_specific<metrics_block> _blocks;
+};
+
+/**
+  @brief The counters of the hot paths. While a scope is active on a
+         thread, the thread counts into the block of the scope, e.g. of the
+         computation that its current task belongs to (see metrics_counts).
+         Otherwise it counts into a process-wide registry, where every
+         thread has a block of its own. Its blocks are summed on demand by
+         snapshot(), the counts of threads that exited are kept.
+*/
+class metrics {
+public:
+  static void add(metric m, std::uint64_t n = 1) {
+    // only this thread writes the counter, others merely read it
+    auto * b = sink();
+    auto & counter = (b ? *b : local()).values[std::size_t(m)];
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+  }
+
+  /**
+    @brief directs the counts of this thread to a block while it lives.
+           Scopes nest.
+  */
+  class scope {
+  public:
+    explicit scope(metrics_block & b) : _previous(sink()) {
+      sink() = &b;
+    }
+
+    ~scope() {
+      sink() = _previous;
+    }
+
+    scope(scope const&) = delete;
+    scope & operator=(scope const&) = delete;
+
+  private:
+    metrics_block * _previous;
+  };
+
+  static metrics_snapshot snapshot() {
+    auto & reg = registry_instance();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    metrics_snapshot sum;
+    sum.values = reg.retired;
+    for (auto const* b : reg.blocks)
+      for (std::size_t i = 0; i < num_metrics; ++i)
+        sum.values[i] += b->values[i].load(std::memory_order_relaxed);
+    return sum;
+  }
+
+private:
+  struct registry {
+    std::mutex                             mutex;
+    std::vector<metrics_block const*>      blocks;
+    std::array<std::uint64_t, num_metrics> retired{};
+  };
+
+  // registers the block of a thread for its lifetime
+  struct local_block : metrics_block {
+    local_block() {
+      auto & reg = registry_instance();
+      std::lock_guard<std::mutex> lock(reg.mutex);
+      reg.blocks.push_back(this);
+    }
+    ~local_block() {
+      auto & reg = registry_instance();
+      std::lock_guard<std::mutex> lock(reg.mutex);
+      for (std::size_t i = 0; i < num_metrics; ++i)
+        reg.retired[i] += values[i].load(std::memory_order_relaxed);
+      reg.blocks.erase(std::find(reg.blocks.begin(), reg.blocks.end(), this));
+    }
+  };
+
+  static registry & registry_instance() {
+    static registry reg;
+    return reg;
+  }
+
+  static metrics_block & local() {
+    thread_local local_block b;
+    return b;
+  }
+
+  // the block of the innermost scope of this thread, if any
+  static metrics_block *& sink() {
+    thread_local metrics_block * b = nullptr;
+    return b;
+  }
+};
+
+}  // namespace FC
+
+#endif  // METRICS_HPP_
@@ -2,20 +2,58 @@
 #define NN_ALONG_RAY_HPP_
 
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
 
+#include <algorithm>
+#include <limits>
 #include <stdexcept>
 #include <utility>
+#include <vector>
 
 #include <Eigen/Core>
 #include <glog/logging.h>
 
+#include "metrics.hpp"
+#include "predicates.hpp"
 #include "vertex_filter.hpp"
 
 namespace FC {
 
 /**
-  @tparam F callable taking a pointer to std::size_t and returning a pointer
-            to an eigen_map
+  @brief the number of candidates that nearest_neighbor_along_ray gathers
+         into a block, to evaluate their dot products with matrix-vector
+         products
+*/
+constexpr std::size_t nn_block_size = 64;
+
+/**
+  @brief the buffers nearest_neighbor_along_ray gathers the candidates in
+*/
+template <typename number_type, typename size_type>
+struct nn_scratch {
+  explicit nn_scratch(size_type dim)
+    : idx_block(nn_block_size), q_block(dim, nn_block_size),
+      x_q(nn_block_size), v_q(nn_block_size), q_q(nn_block_size),
+      num(nn_block_size), den(nn_block_size), num_err(nn_block_size),
+      den_err(nn_block_size), t_lo(nn_block_size), t_hi(nn_block_size) {
+  }
+
+  std::vector<size_type>                                         idx_block;
+  Eigen::Matrix<number_type, Eigen::Dynamic, Eigen::Dynamic>     q_block;
+  Eigen::Matrix<number_type, Eigen::Dynamic, 1>                  x_q;
+  Eigen::Matrix<number_type, Eigen::Dynamic, 1>                  v_q;
+  Eigen::Matrix<number_type, Eigen::Dynamic, 1>                  q_q;
+  Eigen::Array<number_type, Eigen::Dynamic, 1>                   num;
+  Eigen::Array<number_type, Eigen::Dynamic, 1>                   den;
+  Eigen::Array<number_type, Eigen::Dynamic, 1>                   num_err;
+  Eigen::Array<number_type, Eigen::Dynamic, 1>                   den_err;
+  Eigen::Array<number_type, Eigen::Dynamic, 1>                   t_lo;
+  Eigen::Array<number_type, Eigen::Dynamic, 1>                   t_hi;
+};
+
+/**
+  @param get_next the vertex filter that provides the candidate points
   @param begin, end iterators iterators for nearest neighbor storage.
                     If the number of nearest neighbors found exceeds
                     the given range, an exception is thrown.
@@ -27,49 +65,114 @@ nearest_neighbor_along_ray(Eigen::MatrixBase<Derived1> const& x,
                            Eigen::MatrixBase<Derived2> const& v,
                            Eigen::MatrixBase<Derived3> const& p,
                            vertex_filter<Params...> & get_next,
-                           NNIterator begin, NNIterator end) {
+                           NNIterator begin, NNIterator end,
+                           nn_scratch<typename Derived1::Scalar,
+                              typename vertex_filter<Params...>::size_type> &
+                             scratch) {
   DLOG(INFO) << "(Squared) NORM OF RAY " << v.squaredNorm() << std::endl;
   using number_type = typename Derived1::Scalar;
-  // compute some values that don't depend on the candidate points
-  number_type const x_p = x.dot(p);
-  number_type const p_p = p.dot(p);
-  number_type const v_p = v.dot(p);
+  using size_type = typename vertex_filter<Params...>::size_type;
+  using point_type = typename vertex_filter<Params...>::eigen_map;
+  auto const& pc = get_next.pc();
+  // the predicates precompute some values that don't depend on the
+  // candidate points
+  auto const pred = make_ray_predicates(x, v, p);
+  using value_type = typename decltype(pred)::template value<point_type>;
+  value_type nn_value;
+  // the candidates are gathered column-wise, so that the dot products with x
+  // and v are computed for the whole block at once - the squared norms of
+  // the points are precomputed by the point cloud
+  auto & idx_block = scratch.idx_block;
+  auto & q_block = scratch.q_block;
+  auto & x_q = scratch.x_q;
+  auto & v_q = scratch.v_q;
+  auto & q_q = scratch.q_q;
+  auto & num = scratch.num;
+  auto & den = scratch.den;
+  auto & num_err = scratch.num_err;
+  auto & den_err = scratch.den_err;
+  auto & t_lo = scratch.t_lo;
+  auto & t_hi = scratch.t_hi;
+  // an upper bound of the parameter of the nearest neighbor so far
+  number_type nn_t_hi = std::numeric_limits<number_type>::infinity();
   // init return value
   auto r = std::make_pair(begin, number_type(0));
-  typename vertex_filter<Params...>::size_type q_idx;
-  auto * q_ptr = get_next(&q_idx);
-  while (q_ptr) {
-    DLOG(INFO) << "idx probed for stopper in nn-along-ray: " << q_idx << std::endl;
-    auto & q = *q_ptr;
-    number_type const tmp = (v_p - q.dot(v));
-    // if this happens, q is on the boundary of a ball with center
-    // x := x + t * v and t := infinity
-    // during ascend this is no problem
-    // 1) if it only happens at infinity, then we flow to the max at inf as our
-    //    sucessors
-    // 2) if we accpet that, and flow back, then only at infinity do we he have
-    //    q on our boundary, not at the proxy where we proceed during descend
-    if (tmp != 0.0) {
-      number_type const t = (x.dot(q) - x_p + 0.5 * (p_p - q.dot(q))) / tmp;
-      DLOG(INFO) << "t = " << t << " for id = " << q_idx << std::endl;
-      if (t > 0 && (r.first == begin || t <= r.second)) {
-        DLOG(INFO) << "t-DIFF = " << (t - r.second) << std::endl;
-        if (r.first != begin && t == r.second) {
-          if (r.first == end)
-            throw std::logic_error("too many nearest neighbors");
-        } else {
-          r.first = begin;
-          r.second = t;
+  size_type num_fetched;
+  std::uint64_t num_candidates = 0;
+  while ((num_fetched = get_next.fetch(idx_block.begin(), nn_block_size)) > 0) {
+    num_candidates += num_fetched;
+    for (size_type i = 0; i < num_fetched; ++i) {
+      q_block.col(i) = pc[idx_block[i]];
+      q_q[i] = pc.sq_norm(idx_block[i]);
+    }
+    auto const q_cols = q_block.leftCols(num_fetched);
+    x_q.head(num_fetched).noalias() = q_cols.transpose() * x;
+    v_q.head(num_fetched).noalias() = q_cols.transpose() * v;
+    // the parameters of the whole block are evaluated and bounded at once,
+    // such that only the candidates that may come close to the minimum go
+    // through the predicates
+    auto const n = num_fetched;
+    pred.eval_block(x_q.head(n).array(), v_q.head(n).array(),
+                    q_q.head(n).array(), num.head(n), den.head(n),
+                    num_err.head(n), den_err.head(n));
+    pred.t_bounds(num.head(n), den.head(n), num_err.head(n),
+                  den_err.head(n), t_lo.head(n), t_hi.head(n));
+    number_type const threshold =
+        std::min(nn_t_hi, t_hi.head(num_fetched).minCoeff());
+    for (size_type i = 0; i < num_fetched; ++i) {
+      // t_lo is infinite for negative parameters as well
+      if (t_lo[i] > threshold)
+        continue;
+      size_type const q_idx = idx_block[i];
+      DLOG(INFO) << "idx probed for stopper in nn-along-ray: " << q_idx << std::endl;
+      auto const q_value = pred.make_value(pc[q_idx], num[i], den[i],
+                                           num_err[i], den_err[i]);
+      // if the denominator vanishes, q is on the boundary of a ball with
+      // center x := x + t * v and t := infinity
+      // during ascend this is no problem
+      // 1) if it only happens at infinity, then we flow to the max at inf as
+      //    our sucessors
+      // 2) if we accpet that, and flow back, then only at infinity do we he
+      //    have q on our boundary, not at the proxy where we proceed during
+      //    descend
+      if (0 != pred.den_sign(q_value)) {
+        DLOG(INFO) << "t = " << q_value.t() << " for id = " << q_idx << std::endl;
+        // the comparison of t with the current minimum is exact
+        int const cmp = (r.first == begin ? -1 : pred.compare(q_value, nn_value));
+        if (pred.t_sign(q_value) > 0 && cmp <= 0) {
+          DLOG(INFO) << "t-DIFF = " << (q_value.t() - r.second) << std::endl;
+          if (0 == cmp) {
+            if (r.first == end)
+              throw std::logic_error("too many nearest neighbors");
+          } else {
+            r.first = begin;
+            r.second = q_value.t();
+            nn_value = q_value;
+            nn_t_hi = t_hi[i];
+          }
+          *r.first++ = q_idx;
         }
-        *r.first++ = q_idx;
       }
     }
-    q_ptr = get_next(&q_idx);
   }
+  metrics::add(metric::nn_candidates, num_candidates);
   
   return r;
 }
 
+template <class Derived1, class Derived2, class Derived3, class NNIterator,
+          class... Params>
+std::pair<NNIterator, typename Derived1::Scalar>
+nearest_neighbor_along_ray(Eigen::MatrixBase<Derived1> const& x,
+                           Eigen::MatrixBase<Derived2> const& v,
+                           Eigen::MatrixBase<Derived3> const& p,
+                           vertex_filter<Params...> & get_next,
+                           NNIterator begin, NNIterator end) {
+  nn_scratch<typename Derived1::Scalar,
+             typename vertex_filter<Params...>::size_type> scratch(x.size());
+  return nearest_neighbor_along_ray(x, v, p, get_next, begin, end, scratch);
+}
+
 }  // namespace FC
 
 #endif  // NN_ALONG_RAY_HPP_
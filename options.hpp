@@ -0,0 +1,115 @@
+#ifndef OPTIONS_HPP_
+#define OPTIONS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "cancellation.hpp"
+
+namespace FC {
+
+/**
+  @brief options of compute_flow_complex
+*/
+struct compute_options {
+  // if negative, use Intel TBB default
+  int num_threads = -1;
+  // the seed of the random streams that place the initial ascend tasks. Two
+  // computations with the same non-negative seed and number of threads start
+  // with the same tasks. If negative, a random seed is used.
+  std::int64_t seed = -1;
+  // if true, tasks are scheduled by the locations of their critical points
+  // along a space-filling curve (see locality_scheduler), instead of in the
+  // order they are spawned. Experimental, hence not offered by the tool.
+  bool locality_aware = false;
+  // if positive, the number of waiting tasks beyond which the workers
+  // execute depth-first and defer the ascends to the maxima, in order to
+  // keep the memory of the pending tasks low. The frontier still exceeds it
+  // (see bounded_scheduler). Ignored by the locality-aware scheduler.
+  std::size_t frontier_budget = 0;
+  // if not negative, only the critical points up to this index, and the
+  // incidences among them, are computed. For index 0 and 1 the descends are
+  // skipped altogether, see insert_gabriel_edges. From index 2 on it saves
+  // no time: the ascends end at maxima only, and the critical points of
+  // index max_index + 1 are reached by descending through all levels above
+  // them, hence the whole complex is computed and then truncated.
+  int max_index = -1;
+  // if positive, the flow is only followed up to circumballs of this radius,
+  // beyond which flow_complex::max_at_cutoff stands in for the successors.
+  // Every critical point found is one of the whole flow complex, of radius at
+  // most r_max, and so are the incidences among them and with the maximum at
+  // infinity; the incidences with max_at_cutoff are kept apart. The minima
+  // and the Gabriel edges are complete, a critical point of higher index is
+  // missed if the flow that reaches it leaves the cutoff on the way.
+  double r_max = 0;
+  // if positive, no descends start from circumballs smaller than this
+  // radius, hence the critical points below it are only found next to
+  // larger ones, or by the ascends. Confines the refinement of
+  // approximate_flow_complex to the larger critical points.
+  double r_min = 0;
+  // if not empty, the corners of an axis-parallel box: only the critical
+  // points whose circumcenters lie within it are computed. Only a box is
+  // supported, not a set of query points. The ascends start at the points in
+  // the box, and the descends whose balls, grown by the factor 2, do not meet
+  // it are dropped (a heuristic, see process_tasks). As the kd-tree holds all points, the
+  // critical points near the boundary of the box are the ones of the whole
+  // flow complex. The incidences with critical points outside the box are
+  // dropped, except for the ones with the maximum at infinity.
+  std::vector<double> region_min;
+  std::vector<double> region_max;
+  // if true, the critical points outside the region that are incident to
+  // ones inside are kept as well, with only these incidences, such that the
+  // results of adjacent regions can be merged (see restrict_to_region). The
+  // incidences are cleaned (see clean_incidences) before the critical points
+  // outside are dropped.
+  bool region_boundary = false;
+  // if not empty, the state of the computation is written to this file when
+  // it starts, and the changes since are appended every checkpoint_interval
+  // seconds. The workers only hold between their tasks while the waiting
+  // tasks are written. A computation that is cancelled or whose task throws
+  // appends a final checkpoint, a complete one removes the file.
+  // Checkpoints need the default scheduler, i.e. locality_aware is false.
+  std::string checkpoint;
+  double checkpoint_interval = 600;
+  // if true, the computation resumes from the file checkpoint instead of
+  // starting anew. The other options should be the ones of the run that
+  // wrote it.
+  bool resume = false;
+  // once the token is cancelled or the deadline has passed, the workers
+  // discard the waiting tasks instead of executing them, and the flow
+  // complex found so far is returned. It is then flagged as incomplete,
+  // see flow_complex::num_pending_tasks. The search of the Gabriel edges
+  // and the cleaning of a region stop as well, only the kd-tree is built
+  // and the linear trims to max_index and the region are applied in any
+  // case.
+  cancellation_token cancel;
+  std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::time_point::max();
+};
+
+/**
+  @brief options of approximate_flow_complex
+*/
+struct approximation_options {
+  // the fraction of the points in the subsample, which has at least one
+  double sample_fraction = 0.1;
+  // if true, the subsample is grown by farthest-point sampling, which
+  // covers the point cloud evenly but takes time linear in the number of
+  // points for every sample. If false, it is drawn at random.
+  bool farthest_point = false;
+  // if false, the flow complex of the subsample is returned as is
+  bool refine = true;
+  // the critical points of the subsample whose radius is below this multiple
+  // of the covering radius of the subsample are kept as approximations, the
+  // larger ones are refined. If 0, all are refined, which costs about as
+  // much as the exact computation.
+  double refine_radius_factor = 0.5;
+};
+
+}  // namespace FC
+
+#endif  // OPTIONS_HPP_
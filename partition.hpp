@@ -0,0 +1,95 @@
+#ifndef PARTITION_HPP_
+#define PARTITION_HPP_
+
+#include <cstddef>
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+#include <glog/logging.h>
+
+namespace FC {
+
+/**
+  @brief a cell of a spatial partition, an axis-parallel box. The outer
+         cells extend to infinity, so that the cells cover the whole space.
+*/
+struct cell_box {
+  std::vector<double> min;
+  std::vector<double> max;
+};
+
+/**
+  @brief Splits the space into num_cells cells of about the same number of
+         points. A cell is bisected at the median of its points along their
+         widest extent, until there are enough cells.
+  @param begin, end the points, which provide operator[] for their
+                    coordinates
+  @return the cells, in the order of a depth-first traversal of the splits
+*/
+template <typename PointIterator>
+std::vector<cell_box> spatial_cells(PointIterator begin, PointIterator end,
+                                    std::size_t dim, std::size_t num_cells) {
+  std::size_t const num_points = std::distance(begin, end);
+  CHECK(0 < num_cells && num_cells <= num_points) << "cannot split "
+      << num_points << " points into " << num_cells << " cells";
+  double const inf = std::numeric_limits<double>::infinity();
+  std::vector<std::size_t> idx(num_points);
+  std::iota(idx.begin(), idx.end(), 0);
+  auto const coord = [&] (std::size_t i, std::size_t k) {
+    return double(begin[i][k]);
+  };
+  struct split_job {
+    cell_box    box;
+    std::size_t begin;
+    std::size_t end;
+    std::size_t num_cells;
+  };
+  std::vector<cell_box> cells;
+  std::vector<split_job> jobs{
+      {cell_box{std::vector<double>(dim, -inf), std::vector<double>(dim, inf)},
+       0, num_points, num_cells}};
+  while (!jobs.empty()) {
+    split_job job = std::move(jobs.back());
+    jobs.pop_back();
+    if (1 == job.num_cells) {
+      cells.push_back(std::move(job.box));
+      continue;
+    }
+    // the axis of the widest extent of the points in the cell
+    std::size_t axis = 0;
+    double width = -1;
+    for (std::size_t k = 0; k < dim; ++k) {
+      auto const mm = std::minmax_element(
+          idx.begin() + job.begin, idx.begin() + job.end,
+          [&] (std::size_t i, std::size_t j) {return coord(i, k) < coord(j, k);});
+      if (coord(*mm.second, k) - coord(*mm.first, k) > width) {
+        width = coord(*mm.second, k) - coord(*mm.first, k);
+        axis = k;
+      }
+    }
+    // both halves keep at least as many points as cells
+    std::size_t const low_cells = job.num_cells / 2;
+    std::size_t const mid = job.begin +
+        (job.end - job.begin) * low_cells / job.num_cells;
+    std::nth_element(idx.begin() + job.begin, idx.begin() + mid,
+                     idx.begin() + job.end,
+                     [&] (std::size_t i, std::size_t j) {
+                       return coord(i, axis) < coord(j, axis);
+                     });
+    double const split = coord(idx[mid], axis);
+    split_job high{job.box, mid, job.end, job.num_cells - low_cells};
+    high.box.min[axis] = split;
+    job.box.max[axis] = split;
+    jobs.push_back(std::move(high));
+    jobs.push_back(split_job{std::move(job.box), job.begin, mid, low_cells});
+  }
+  return cells;
+}
+
+}  // namespace FC
+
+#endif  // PARTITION_HPP_
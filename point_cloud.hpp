@@ -2,7 +2,9 @@
 #define POINT_CLOUD_HPP_
 
 #include <cassert>
+#include <cmath>
 
+#include <algorithm>
 #include <iterator>
 #include <memory>
 #include <tuple>
@@ -10,6 +12,7 @@
 
 #include <gflags/gflags.h>
 #include <Eigen/Core>
+#include <Eigen/Dense>
 #ifdef _MSC_VER
   #pragma warning(push)
   #pragma warning( disable : 4267)
@@ -19,6 +22,7 @@
   #include <nanoflann.hpp>
 #endif
 
+#include "predicates.hpp"
 #include "utility.hpp"
 
 DEFINE_int32(kdtree_leaf_size, 16, "maximal number of indices in kd-tree "
@@ -73,9 +77,19 @@ using eigen_vector = Eigen::Matrix<_number_type, Eigen::Dynamic, 1>;
 using self_t = point_cloud<_number_type, _size_type, Aligned>;
 using DataAdaptor = NanoflannDataAdaptor<self_t>;
 using DistFunc = nanoflann::L2_Simple_Adaptor<_number_type, DataAdaptor>;
-using KDTree = nanoflann::KDTreeSingleIndexAdaptor<DistFunc, DataAdaptor,
+using KDTreeBase = nanoflann::KDTreeSingleIndexAdaptor<DistFunc, DataAdaptor,
                           -1,  // dimension of the dataset: -1 == known at rt
                           _size_type>;
+// exposes the tree structure of nanoflann for flattening
+struct KDTree : KDTreeBase {
+  template <class Params>
+  KDTree(int dim, DataAdaptor const& adaptor, Params const& params)
+    : KDTreeBase(dim, adaptor, params) {
+  }
+  using typename KDTreeBase::NodePtr;
+  using KDTreeBase::root_node;
+  using KDTreeBase::vind;
+};
 // forward declaration
 template <class Iterator> struct RadiusSearchResultSet;
 public:
@@ -87,40 +101,45 @@ private:
   using pt_cont = std::vector<eigen_map>;
 public:
   typedef typename pt_cont::const_iterator        iterator;
+
+  /**
+    @brief a node of the flattened kd-tree. The points of the node are
+           kd_index(begin), ..., kd_index(end - 1). Node 0 is the root, hence
+           a child index of 0 marks a leaf.
+  */
+  struct kd_node {
+    size_type child1;
+    size_type child2;
+    size_type begin;
+    size_type end;
+
+    bool is_leaf() const {
+      return 0 == child1;
+    }
+  };
   /**
     @tparam Iterator when dereferenced, returns a pointer to number_type
   */
   template <typename Iterator, typename dim_type>
   point_cloud(Iterator begin, Iterator end, dim_type dim)
-  : _points(), _data_adaptor(*this), _kd_tree(nullptr), diameter_(0.0) {
+  : _points(), _sq_norms(), _data_adaptor(*this), _kd_tree(nullptr),
+    diameter_(0.0) {
     auto const size = std::distance(begin, end);
     _points.reserve(size);
-    for (auto it = begin; it != end; ++it)
+    _sq_norms.reserve(size);
+    for (auto it = begin; it != end; ++it) {
       _points.emplace_back(&((*it)[0]), dim);
+      _sq_norms.push_back(_points.back().squaredNorm());
+    }
     using Params = nanoflann::KDTreeSingleIndexAdaptorParams;
     CHECK(FLAGS_kdtree_leaf_size > 0);
     _kd_tree.reset(new KDTree(dim, _data_adaptor,
                               Params(FLAGS_kdtree_leaf_size)));
     _kd_tree->buildIndex();
-    // compute diameter of dataset
-    number_type sq_diameter = 0.0;
-    #pragma omp parallel
-    {
-      number_type my_sq_diameter = 0.0;
-      #pragma omp for schedule(guided, 100)
-      for (int i = 0; i < this->size(); ++i) {
-        for (int j = i + 1; j < this->size(); ++j) {
-          const auto& u = _points[i];
-          const auto& v = _points[j];
-          const number_type sq_distance = (u-v).squaredNorm();
-          if (sq_distance > my_sq_diameter) my_sq_diameter = sq_distance;
-        }
-      }
-      // workaround: MSVC does not support reduction(max:sq_diameter)
-      #pragma omp critical (max_reduction)
-      if (my_sq_diameter > sq_diameter) sq_diameter = my_sq_diameter;
-    }
-    diameter_ = sqrt(sq_diameter);
+    flatten_kd_tree();
+    // the diagonal of the bounding box bounds the diameter from above, and
+    // is found in linear time
+    diameter_ = (bounding_box_max() - bounding_box_min()).norm();
   }
   
   iterator begin() const noexcept {
@@ -137,6 +156,15 @@ public:
     return _points[idx];
   }
   
+  /**
+    @return the precomputed squared norm of the point at idx
+  */
+  template <typename Index>
+  number_type sq_norm(Index idx) const {
+    DCHECK(typename pt_cont::size_type(idx) < _sq_norms.size());
+    return _sq_norms[idx];
+  }
+  
   size_type dim() const noexcept {
     CHECK(!_points.empty() && "YOU CREATED AN EMPTY POINT CLOUD.");
     return convertSafelyTo<size_type>(_points[0].size());
@@ -146,8 +174,56 @@ public:
     return convertSafelyTo<size_type>(_points.size());
   }
   
+  /**
+    @return an upper bound of the diameter, at most sqrt(dim()) times it
+  */
   number_type diameter() const {return diameter_;}
   
+  /**
+    @return the lower and upper corner of the bounding box of all points,
+            which is the box of the root of the kd-tree
+  */
+  eigen_vector bounding_box_min() const {return _kd_box_lo.col(0);}
+  eigen_vector bounding_box_max() const {return _kd_box_hi.col(0);}
+  
+  kd_node const& kd_tree_node(size_type node) const {
+    DCHECK(typename std::vector<kd_node>::size_type(node) < _kd_nodes.size());
+    return _kd_nodes[node];
+  }
+  
+  size_type kd_index(size_type pos) const {
+    return _kd_indices[pos];
+  }
+  
+  /**
+    @return the squared distance of q to the (tight) bounding box of the
+            points of node
+  */
+  template <class Derived>
+  number_type kd_box_sq_distance(size_type node,
+                                 Eigen::MatrixBase<Derived> const& q) const {
+    return (_kd_box_lo.col(node) - q).cwiseMax(q - _kd_box_hi.col(node))
+                                     .cwiseMax(number_type(0)).squaredNorm();
+  }
+  
+  /**
+    @return true if the (tight) bounding box of the points of node lies in the
+            open halfspace v * q > c, also if c is off by up to c_err
+  */
+  template <class Derived>
+  bool kd_box_in_halfspace(size_type node, Eigen::MatrixBase<Derived> const& v,
+                           number_type c, number_type c_err) const {
+    number_type const eps = error_factor<number_type>(dim() + 1);
+    // the minimum of v * q over the box is attained at one of its corners
+    auto const& lo = _kd_box_lo.col(node);
+    auto const& hi = _kd_box_hi.col(node);
+    number_type const lower = v.cwiseMax(number_type(0)).dot(lo) +
+                              v.cwiseMin(number_type(0)).dot(hi);
+    number_type const lower_err =
+        eps * v.cwiseAbs().dot(lo.cwiseAbs().cwiseMax(hi.cwiseAbs()));
+    return lower - lower_err > c + c_err;
+  }
+  
   /**
     @brief Finds the nearest neighbor to q. In case of more than one nearest
            neighbor, returns the lowest index.
@@ -200,7 +276,101 @@ public:
     return result.end();
   }
 
+  /**
+    @brief Branch-and-bound search for points q in the open halfspace
+           v * q > c. Subtrees whose bounding boxes are certified to lie in
+           the closed halfspace v * q <= c are pruned, the points of all
+           other leaves are passed to fn.
+    @param c_err an upper bound on the absolute error of c
+    @param fn called with the indices of the points that are not pruned,
+              the search stops as soon as it returns true
+    @return true iff fn returned true for some point
+  */
+  template <class Derived, class PointFn>
+  bool halfspace_search(Eigen::MatrixBase<Derived> const& v, number_type c,
+                        number_type c_err, PointFn const& fn) const {
+    using std::abs;
+    number_type const eps = error_factor<number_type>(dim() + 1);
+    eigen_vector const v_pos = v.cwiseMax(number_type(0));
+    eigen_vector const v_neg = v.cwiseMin(number_type(0));
+    eigen_vector const v_abs = v.cwiseAbs();
+    std::vector<size_type> nodes(1, size_type(0));
+    while (!nodes.empty()) {
+      size_type const node_idx = nodes.back();
+      nodes.pop_back();
+      // the maximum of v * q over the box is attained at one of its corners
+      auto const& lo = _kd_box_lo.col(node_idx);
+      auto const& hi = _kd_box_hi.col(node_idx);
+      number_type const support = v_pos.dot(hi) + v_neg.dot(lo);
+      number_type const support_err =
+          eps * v_abs.dot(lo.cwiseAbs().cwiseMax(hi.cwiseAbs()));
+      if (support + support_err < c - c_err)
+        continue;
+      auto const& node = _kd_nodes[node_idx];
+      if (node.is_leaf()) {
+        for (size_type pos = node.begin; pos < node.end; ++pos)
+          if (fn(_kd_indices[pos]))
+            return true;
+      } else {
+        nodes.push_back(node.child2);
+        nodes.push_back(node.child1);
+      }
+    }
+    return false;
+  }
+
 private:
+  /**
+    @brief copies the structure of the nanoflann kd-tree into contiguous
+           arrays (in depth-first order) and computes tight bounding boxes
+  */
+  void flatten_kd_tree() {
+    auto const& vind = _kd_tree->vind;
+    _kd_indices.assign(vind.begin(), vind.end());
+    _kd_nodes.clear();
+    flatten_kd_subtree(_kd_tree->root_node);
+    size_type const num_nodes = convertSafelyTo<size_type>(_kd_nodes.size());
+    _kd_box_lo.resize(dim(), num_nodes);
+    _kd_box_hi.resize(dim(), num_nodes);
+    // children have larger indices than their parents
+    for (size_type i = num_nodes; i-- > 0;) {
+      auto const& node = _kd_nodes[i];
+      if (node.is_leaf()) {
+        _kd_box_lo.col(i) = _points[_kd_indices[node.begin]];
+        _kd_box_hi.col(i) = _kd_box_lo.col(i);
+        for (size_type pos = node.begin + 1; pos < node.end; ++pos) {
+          auto const& p = _points[_kd_indices[pos]];
+          _kd_box_lo.col(i) = _kd_box_lo.col(i).cwiseMin(p);
+          _kd_box_hi.col(i) = _kd_box_hi.col(i).cwiseMax(p);
+        }
+      } else {
+        _kd_box_lo.col(i) = _kd_box_lo.col(node.child1)
+                            .cwiseMin(_kd_box_lo.col(node.child2));
+        _kd_box_hi.col(i) = _kd_box_hi.col(node.child1)
+                            .cwiseMax(_kd_box_hi.col(node.child2));
+      }
+    }
+  }
+
+  // @return the index of the flattened node
+  size_type flatten_kd_subtree(typename KDTree::NodePtr node) {
+    size_type const idx = convertSafelyTo<size_type>(_kd_nodes.size());
+    _kd_nodes.push_back(kd_node());
+    if (!node->child1 && !node->child2) {
+      _kd_nodes[idx].child1 = _kd_nodes[idx].child2 = 0;
+      _kd_nodes[idx].begin = convertSafelyTo<size_type>(node->node_type.lr.left);
+      _kd_nodes[idx].end = convertSafelyTo<size_type>(node->node_type.lr.right);
+    } else {
+      size_type const child1 = flatten_kd_subtree(node->child1);
+      size_type const child2 = flatten_kd_subtree(node->child2);
+      _kd_nodes[idx].child1 = child1;
+      _kd_nodes[idx].child2 = child2;
+      _kd_nodes[idx].begin = _kd_nodes[child1].begin;
+      _kd_nodes[idx].end = _kd_nodes[child2].end;
+    }
+    return idx;
+  }
+
   template <class Iterator>
   struct RadiusSearchResultSet {
   public:
@@ -231,11 +401,157 @@ private:
   };
 
   pt_cont                       _points;
+  std::vector<number_type>     _sq_norms;
   DataAdaptor             _data_adaptor;
   std::unique_ptr<KDTree>      _kd_tree;
+  std::vector<kd_node>        _kd_nodes;
+  std::vector<size_type>    _kd_indices;
+  Eigen::Matrix<number_type, Eigen::Dynamic, Eigen::Dynamic> _kd_box_lo;
+  Eigen::Matrix<number_type, Eigen::Dynamic, Eigen::Dynamic> _kd_box_hi;
   _number_type                diameter_;
 };
 
+/**
+  @brief Incremental search for the points within a sequence of growing balls.
+         The traversal of the kd-tree resumes from the frontier of the
+         previous query - i.e. the nodes whose bounding boxes, and the
+         points which were outside the previous ball - instead of starting
+         from the root again.
+         The balls need not be nested: the pending points, and the nodes
+         that were not entered, are checked against every new ball. This
+         matters for the ascend tasks, which probe for stopper candidates
+         with balls that touch a common point while their centers move away
+         from it along a ray - the points behind the ray leave the balls.
+         Points that were found within a ball are not checked again, though,
+         so the queries are meant to stop at the first ball that is not
+         empty (and collect() to be called with that ball).
+*/
+template <class PointCloud>
+class growing_ball_search {
+public:
+  typedef typename PointCloud::number_type number_type;
+  typedef typename PointCloud::size_type   size_type;
+
+  growing_ball_search(PointCloud const& pc)
+    : _pc(pc), _center(pc.dim()), _nodes(1, size_type(0)),
+      _deferred_nodes(), _pending(), _found() {
+  }
+
+  /**
+    @brief starts a new sequence of balls, keeping the allocated memory
+  */
+  void reset() {
+    _nodes.assign(1, size_type(0));
+    _deferred_nodes.clear();
+    _pending.clear();
+    _found.clear();
+  }
+
+  /**
+    @brief emptiness-only query: stops traversing as soon as a single point,
+           which is not ignored, is found within the ball
+    @return true if there is no such point within the ball
+  */
+  template <class Derived, class IgnoreFn>
+  bool is_empty(Eigen::MatrixBase<Derived> const& center,
+                number_type sq_radius, IgnoreFn const& ignoreFn) {
+    if (_found.empty())
+      advance(center, sq_radius, ignoreFn, true);
+    return _found.empty();
+  }
+
+  /**
+    @brief writes all points within the ball, which are not ignored, to the
+           range starting at out. These include those found by previous
+           queries.
+    @return the end of the written range
+  */
+  template <class Derived, class IgnoreFn, class Iterator>
+  Iterator collect(Eigen::MatrixBase<Derived> const& center,
+                   number_type sq_radius, IgnoreFn const& ignoreFn,
+                   Iterator out) {
+    advance(center, sq_radius, ignoreFn, false);
+    return std::copy(_found.begin(), _found.end(), out);
+  }
+
+private:
+  template <class Derived, class IgnoreFn>
+  void advance(Eigen::MatrixBase<Derived> const& center_expr,
+               number_type sq_radius, IgnoreFn const& ignoreFn,
+               bool stop_if_found) {
+    // the center is usually an expression like x + t * v, which would be
+    // evaluated again for every point and box
+    _center = center_expr;
+    auto const& center = _center;
+    auto const is_inside = [&](size_type idx) {
+      return (_pc[idx] - center).squaredNorm() < sq_radius;
+    };
+    // points of the frontier
+    auto const pending_end = std::partition(_pending.begin(), _pending.end(),
+                                            [&](size_type idx) {
+                                              return !is_inside(idx);
+                                            });
+    _found.insert(_found.end(), pending_end, _pending.end());
+    _pending.erase(pending_end, _pending.end());
+    // nodes of the frontier
+    while (!_nodes.empty() && !(stop_if_found && !_found.empty())) {
+      size_type const node_idx = _nodes.back();
+      _nodes.pop_back();
+      // like nanoflann, the boundary of the box counts as intersecting
+      if (_pc.kd_box_sq_distance(node_idx, center) > sq_radius) {
+        _deferred_nodes.push_back(node_idx);
+        continue;
+      }
+      auto const& node = _pc.kd_tree_node(node_idx);
+      if (node.is_leaf()) {
+        for (size_type pos = node.begin; pos < node.end; ++pos) {
+          size_type const idx = _pc.kd_index(pos);
+          if (!ignoreFn(idx))
+            (is_inside(idx) ? _found : _pending).push_back(idx);
+        }
+      } else {
+        _nodes.push_back(node.child2);
+        _nodes.push_back(node.child1);
+      }
+    }
+    _nodes.insert(_nodes.end(), _deferred_nodes.begin(),
+                  _deferred_nodes.end());
+    _deferred_nodes.clear();
+  }
+
+  PointCloud const&      _pc;
+  Eigen::Matrix<number_type, Eigen::Dynamic, 1> _center;
+  std::vector<size_type> _nodes;
+  std::vector<size_type> _deferred_nodes;
+  std::vector<size_type> _pending;
+  std::vector<size_type> _found;
+};
+
+/**
+  @return the center of the smallest sphere through the points with the
+          given indices, i.e. the location of the critical point they
+          support
+*/
+template <class PointCloud, class Iterator>
+Eigen::Matrix<typename PointCloud::number_type, Eigen::Dynamic, 1>
+circumcenter(PointCloud const& pc, Iterator begin, Iterator end) {
+  using number_type = typename PointCloud::number_type;
+  using eigen_vector = Eigen::Matrix<number_type, Eigen::Dynamic, 1>;
+  using eigen_matrix = Eigen::Matrix<number_type, Eigen::Dynamic,
+                                     Eigen::Dynamic>;
+  eigen_vector const p0 = pc[*begin];
+  auto const k = std::distance(begin, end) - 1;
+  if (0 == k)
+    return p0;
+  // the center is p0 + A * y with A^T A y = 0.5 * diag(A^T A)
+  eigen_matrix A(pc.dim(), k);
+  for (auto i = 0; ++begin != end; ++i)
+    A.col(i) = pc[*begin] - p0;
+  eigen_matrix const AtA = A.transpose() * A;
+  eigen_vector const y = AtA.ldlt().solve(0.5 * AtA.diagonal());
+  return p0 + A * y;
+}
+
 }  // namespace FC
 
 #endif  // POINT_CLOUD_HPP_
@@ -0,0 +1,403 @@
+#ifndef PREDICATES_HPP_
+#define PREDICATES_HPP_
+
+#include <cassert>
+#include <cmath>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include <Eigen/Core>
+
+namespace FC {
+
+/**
+  @brief error-free transformation of a sum: a + b == s + e exactly
+*/
+template <typename Float>
+void two_sum(Float a, Float b, Float & s, Float & e) {
+  s = a + b;
+  Float const b_virt = s - a;
+  Float const a_virt = s - b_virt;
+  e = (a - a_virt) + (b - b_virt);
+}
+
+/**
+  @brief error-free transformation of a product: a * b == p + e exactly
+         (barring underflow)
+*/
+template <typename Float>
+void two_product(Float a, Float b, Float & p, Float & e) {
+  using std::fma;
+  p = a * b;
+  e = fma(a, b, -p);
+}
+
+/**
+  @brief a floating-point expansion, i.e. an unevaluated sum of
+         non-overlapping components sorted by increasing magnitude, which
+         represents sums of products of floating-point numbers exactly.
+         The algorithms are the ones of Shewchuk's "Adaptive Precision
+         Floating-Point Arithmetic and Fast Robust Geometric Predicates".
+         It is meant for the slow path of the filtered predicates below
+         only, hence there is no effort to avoid allocations.
+*/
+template <typename Float>
+class expansion {
+public:
+  expansion() : _c() {
+  }
+
+  // adds a to the expansion (GROW-EXPANSION with zero elimination)
+  void add(Float a) {
+    std::size_t pos = 0;
+    for (std::size_t i = 0; i < _c.size(); ++i) {
+      Float s, e;
+      two_sum(a, _c[i], s, e);
+      a = s;
+      if (0 != e)
+        _c[pos++] = e;
+    }
+    _c.resize(pos);
+    if (0 != a)
+      _c.push_back(a);
+  }
+
+  void add_product(Float a, Float b) {
+    Float p, e;
+    two_product(a, b, p, e);
+    add(e);
+    add(p);
+  }
+
+  void add(expansion const& rhs) {
+    for (auto c : rhs._c)
+      add(c);
+  }
+
+  expansion & negate() {
+    for (auto & c : _c)
+      c = -c;
+    return *this;
+  }
+
+  expansion operator*(expansion const& rhs) const {
+    expansion r;
+    for (auto a : _c)
+      for (auto b : rhs._c)
+        r.add_product(a, b);
+    return r;
+  }
+
+  /**
+    @return -1, 0, or 1, the exact sign of the represented number
+  */
+  int sign() const {
+    // the largest component determines the sign
+    return _c.empty() ? 0 : (_c.back() > 0 ? 1 : -1);
+  }
+
+  Float estimate() const {
+    Float r(0);
+    for (auto c : _c)
+      r += c;
+    return r;
+  }
+
+private:
+  std::vector<Float> _c;
+};
+
+/**
+  @brief an upper bound on the relative error of a computation with n
+         floating-point operations (twice the usual gamma_n for safety)
+*/
+template <typename Float>
+Float error_factor(std::size_t n) {
+  return static_cast<Float>(n) * std::numeric_limits<Float>::epsilon();
+}
+
+/**
+  @return the sign of a value that is known up to an absolute error, or
+          0 if the sign can not be certified by the error bound
+*/
+template <typename Float>
+int filtered_sign(Float value, Float error) {
+  return value > error ? 1 : (value < -error ? -1 : 0);
+}
+
+/**
+  @brief Filtered predicates for the search of the nearest neighbor along a
+         ray x + t * v, where p is a point on the boundary of the ball
+         centered at x (see nearest_neighbor_along_ray).
+         The parameter t of a point q is num(q) / den(q) with
+           num(q) = x * q - x * p + 0.5 * (p * p - q * q) and
+           den(q) = v * p - v * q.
+         Signs and comparisons of these parameters are first evaluated in
+         floating-point together with an error bound. Only if the bound
+         does not certify the result, num and den are evaluated exactly
+         using expansions of the (floating-point) input coordinates.
+*/
+template <class DerivedX, class DerivedV, class DerivedP>
+class ray_parameter_predicates {
+  template <class Derived> using vector_ref = Eigen::MatrixBase<Derived> const&;
+public:
+  typedef typename DerivedX::Scalar number_type;
+
+  /**
+    @brief the floating-point evaluation of num(q) and den(q) along with
+           their absolute error bounds
+  */
+  template <class Point>
+  struct value {
+    number_type num;
+    number_type den;
+    number_type num_err;
+    number_type den_err;
+    Point const* q;
+
+    number_type t() const {
+      return num / den;
+    }
+  };
+
+  ray_parameter_predicates(vector_ref<DerivedX> x, vector_ref<DerivedV> v,
+                           vector_ref<DerivedP> p)
+    : _x(x), _v(v), _p(p), _x_p(x.dot(p)), _p_p(p.dot(p)), _v_p(v.dot(p)),
+      _x_norm(x.norm()), _v_norm(v.norm()), _p_norm(p.norm()),
+      _num_eps(error_factor<number_type>(x.size() + 4)),
+      _den_eps(error_factor<number_type>(x.size() + 2)) {
+  }
+
+  /**
+    @param x_q, v_q, q_q the (floating-point) dot products of q with x, v and
+                         itself
+  */
+  template <class Point>
+  value<Point> eval(Point const& q, number_type x_q, number_type v_q,
+                    number_type q_q) const {
+    using std::sqrt;
+    value<Point> r;
+    r.num = x_q - _x_p + 0.5 * (_p_p - q_q);
+    r.den = _v_p - v_q;
+    number_type const q_norm = sqrt(q_q);
+    r.num_err = _num_eps * (_x_norm * (q_norm + _p_norm) +
+                            0.5 * (_p_norm * _p_norm + q_q));
+    r.den_err = _den_eps * _v_norm * (_p_norm + q_norm);
+    r.q = &q;
+    return r;
+  }
+
+  /**
+    @brief eval() for a block of points at once, which fills the arrays
+           num, den, num_err and den_err
+    @param x_q, v_q, q_q the dot products of the points with x, v and
+                         themselves
+  */
+  template <class A1, class A2, class A3, class A4>
+  void eval_block(Eigen::ArrayBase<A1> const& x_q,
+                  Eigen::ArrayBase<A1> const& v_q,
+                  Eigen::ArrayBase<A1> const& q_q,
+                  Eigen::ArrayBase<A2> const& num_const,
+                  Eigen::ArrayBase<A2> const& den_const,
+                  Eigen::ArrayBase<A3> const& num_err_const,
+                  Eigen::ArrayBase<A4> const& den_err_const) const {
+    auto & num = const_cast<Eigen::ArrayBase<A2> &>(num_const);
+    auto & den = const_cast<Eigen::ArrayBase<A2> &>(den_const);
+    auto & num_err = const_cast<Eigen::ArrayBase<A3> &>(num_err_const);
+    auto & den_err = const_cast<Eigen::ArrayBase<A4> &>(den_err_const);
+    num = x_q - _x_p + 0.5 * (_p_p - q_q);
+    den = _v_p - v_q;
+    // |q| is kept in den_err until both bounds are computed
+    den_err = q_q.sqrt();
+    num_err = _num_eps * (_x_norm * (den_err + _p_norm) +
+                          0.5 * (_p_norm * _p_norm + q_q));
+    den_err = _den_eps * _v_norm * (_p_norm + den_err);
+  }
+
+  /**
+    @return the value of eval() from the entries of eval_block()
+  */
+  template <class Point>
+  value<Point> make_value(Point const& q, number_type num, number_type den,
+                          number_type num_err, number_type den_err) const {
+    value<Point> r;
+    r.num = num;
+    r.den = den;
+    r.num_err = num_err;
+    r.den_err = den_err;
+    r.q = &q;
+    return r;
+  }
+
+  /**
+    @brief bounds of the parameters t from the values of eval_block(): where
+           the signs of num and den are certified and equal, t lies in
+           [t_lo, t_hi]. Where they are certified and differ, t is negative
+           and t_lo = t_hi = infinity. Else t_lo = -infinity and
+           t_hi = infinity.
+  */
+  template <class A1, class A2, class A3>
+  static void t_bounds(Eigen::ArrayBase<A1> const& num,
+                       Eigen::ArrayBase<A1> const& den,
+                       Eigen::ArrayBase<A2> const& num_err,
+                       Eigen::ArrayBase<A2> const& den_err,
+                       Eigen::ArrayBase<A3> const& t_lo_const,
+                       Eigen::ArrayBase<A3> const& t_hi_const) {
+    using std::abs;
+    auto & t_lo = const_cast<Eigen::ArrayBase<A3> &>(t_lo_const);
+    auto & t_hi = const_cast<Eigen::ArrayBase<A3> &>(t_hi_const);
+    number_type const inf = std::numeric_limits<number_type>::infinity();
+    // the rounding of the quotients
+    number_type const div_eps = error_factor<number_type>(4);
+    for (typename A1::Index i = 0; i < num.size(); ++i) {
+      number_type const a_num = abs(num[i]);
+      number_type const a_den = abs(den[i]);
+      if (a_num <= num_err[i] || a_den <= den_err[i]) {
+        t_lo[i] = -inf;
+        t_hi[i] = inf;
+      } else if ((num[i] > 0) != (den[i] > 0)) {
+        t_lo[i] = inf;
+        t_hi[i] = inf;
+      } else {
+        t_lo[i] = (a_num - num_err[i]) / (a_den + den_err[i]) * (1 - div_eps);
+        t_hi[i] = (a_num + num_err[i]) / (a_den - den_err[i]) * (1 + div_eps);
+      }
+    }
+  }
+
+  template <class Point>
+  int den_sign(value<Point> const& a) const {
+    int const s = filtered_sign(a.den, a.den_err);
+    return 0 != s ? s : exact_den(*a.q).sign();
+  }
+
+  /**
+    @return the sign of the parameter t of a, assuming den_sign(a) != 0
+  */
+  template <class Point>
+  int t_sign(value<Point> const& a) const {
+    int const s_den = den_sign(a);
+    int s_num = filtered_sign(a.num, a.num_err);
+    if (0 == s_num)
+      s_num = exact_num(*a.q).sign();
+    return s_num * s_den;
+  }
+
+  /**
+    @return -1, 0, or 1 if the parameter t of a is smaller than, equal to,
+            or greater than the parameter t of b, respectively
+  */
+  template <class Point>
+  int compare(value<Point> const& a, value<Point> const& b) const {
+    using std::abs;
+    int const s_den = den_sign(a) * den_sign(b);
+    // t_a - t_b = (num_a * den_b - num_b * den_a) / (den_a * den_b)
+    number_type const l = a.num * b.den;
+    number_type const r = b.num * a.den;
+    number_type const err =
+        a.num_err * abs(b.den) + abs(a.num) * b.den_err + a.num_err * b.den_err +
+        b.num_err * abs(a.den) + abs(b.num) * a.den_err + b.num_err * a.den_err +
+        error_factor<number_type>(3) * (abs(l) + abs(r));
+    int s = filtered_sign(l - r, err);
+    if (0 == s) {
+      auto diff = exact_num(*a.q) * exact_den(*b.q);
+      diff.add((exact_num(*b.q) * exact_den(*a.q)).negate());
+      s = diff.sign();
+    }
+    return s * s_den;
+  }
+
+private:
+  template <class Point>
+  expansion<number_type> exact_num(Point const& q) const {
+    expansion<number_type> r;
+    for (typename DerivedX::Index i = 0; i < _x.size(); ++i) {
+      r.add_product(_x[i], q[i]);
+      r.add_product(-_x[i], _p[i]);
+      // scaling by a power of 2 is exact
+      r.add_product(0.5 * _p[i], _p[i]);
+      r.add_product(-0.5 * q[i], q[i]);
+    }
+    return r;
+  }
+
+  template <class Point>
+  expansion<number_type> exact_den(Point const& q) const {
+    expansion<number_type> r;
+    for (typename DerivedV::Index i = 0; i < _v.size(); ++i) {
+      r.add_product(_v[i], _p[i]);
+      r.add_product(-_v[i], q[i]);
+    }
+    return r;
+  }
+
+  vector_ref<DerivedX> _x;
+  vector_ref<DerivedV> _v;
+  vector_ref<DerivedP> _p;
+  number_type const _x_p;
+  number_type const _p_p;
+  number_type const _v_p;
+  number_type const _x_norm;
+  number_type const _v_norm;
+  number_type const _p_norm;
+  number_type const _num_eps;
+  number_type const _den_eps;
+};
+
+/**
+  @brief compensated summation of sums and products (Ogita, Rump and Oishi's
+         Sum2 and Dot2): the result is as accurate as if computed in twice
+         the working precision
+*/
+template <typename Float>
+class accurate_sum {
+public:
+  accurate_sum() : _s(0), _c(0) {
+  }
+
+  void add(Float a) {
+    Float e;
+    two_sum(_s, a, _s, e);
+    _c += e;
+  }
+
+  void add_product(Float a, Float b) {
+    Float p, e_p, e_s;
+    two_product(a, b, p, e_p);
+    two_sum(_s, p, _s, e_s);
+    _c += e_p + e_s;
+  }
+
+  Float value() const {
+    return _s + _c;
+  }
+
+private:
+  Float _s;
+  Float _c;
+};
+
+template <class Derived1, class Derived2>
+typename Derived1::Scalar
+accurate_dot(Eigen::MatrixBase<Derived1> const& a,
+             Eigen::MatrixBase<Derived2> const& b) {
+  using number_type = typename Derived1::Scalar;
+  accurate_sum<number_type> r;
+  for (typename Derived1::Index i = 0; i < a.size(); ++i)
+    r.add_product(a[i], b[i]);
+  return r.value();
+}
+
+template <class Derived1, class Derived2, class Derived3>
+ray_parameter_predicates<Derived1, Derived2, Derived3>
+make_ray_predicates(Eigen::MatrixBase<Derived1> const& x,
+                    Eigen::MatrixBase<Derived2> const& v,
+                    Eigen::MatrixBase<Derived3> const& p) {
+  return ray_parameter_predicates<Derived1, Derived2, Derived3>(x, v, p);
+}
+
+}  // namespace FC
+
+#endif  // PREDICATES_HPP_
@@ -0,0 +1,210 @@
+#ifndef QR_CACHE_HPP_
+#define QR_CACHE_HPP_
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <tbb/spin_mutex.h>
+
+#include "dynamic_qr.hpp"
+#include "random.hpp"
+
+DEFINE_int32(qr_cache_capacity, 0, "maximal number of QR factorizations of "
+                                   "affine hulls that are cached during the "
+                                   "computation, 0 disables the cache");
+
+namespace FC {
+
+/**
+  @brief hit-rate statistics of a qr_cache
+*/
+struct qr_cache_statistics {
+  std::size_t hits = 0;
+  std::size_t misses = 0;
+  std::size_t insertions = 0;
+  std::size_t evictions = 0;
+  std::size_t size = 0;
+  std::size_t bytes = 0;  // estimated memory consumption of the entries
+
+  double hit_rate() const {
+    std::size_t const lookups = hits + misses;
+    return lookups > 0 ? double(hits) / lookups : 0.0;
+  }
+};
+
+template <typename OStream>
+OStream & operator<<(OStream & os, qr_cache_statistics const& stats) {
+  os << "qr cache: " << stats.hits << " hits, " << stats.misses << " misses ("
+     << 100.0 * stats.hit_rate() << "% hit rate), " << stats.insertions
+     << " insertions, " << stats.evictions << " evictions, " << stats.size
+     << " entries (~" << stats.bytes / 1024 << " KiB)";
+  return os;
+}
+
+/**
+  @brief A bounded, concurrent cache that maps the index set of an affine
+         hull to a finished QR factorization of it, together with the member
+         order the factorization belongs to.
+         Index sets are looked up by a hash that does not depend on the
+         order of the indices (see hash_of), so that an affine hull can
+         update the hash of its members by one index and look up its
+         neighbours without building and sorting their index sets.
+         The cache is split into shards that are guarded by spin mutexes.
+         Every shard evicts its oldest entries first, once it holds more than
+         its share of the capacity.
+*/
+template <typename _number_type, typename _size_type>
+class qr_cache {
+public:
+  typedef _number_type              number_type;
+  typedef _size_type                size_type;
+  typedef dynamic_qr<number_type>   qr_type;
+
+  struct entry {
+    std::vector<size_type> members;
+    qr_type                qr;
+  };
+  typedef std::shared_ptr<entry const> entry_ptr;
+
+private:
+  struct shard {
+    tbb::spin_mutex                                    mutex;
+    std::unordered_multimap<std::uint64_t, entry_ptr>  map;
+    // the hashes and entries in the order of their insertion
+    std::deque<std::pair<std::uint64_t, entry const*>> fifo;
+  };
+
+public:
+  /**
+    @param capacity the maximal number of entries, must be positive
+  */
+  qr_cache(std::size_t capacity, std::size_t num_shards = 64)
+    : _shards(std::min(num_shards, capacity)),
+      _shard_capacity((capacity + _shards.size() - 1) / _shards.size()),
+      _hits(0), _misses(0), _insertions(0), _evictions(0), _bytes(0) {
+    assert(capacity > 0);
+  }
+
+  qr_cache(qr_cache const&) = delete;
+  qr_cache & operator=(qr_cache const&) = delete;
+
+  /**
+    @brief the hash of a single index. The hash of an index set is the sum
+           of the hashes of its indices, hence it is updated by adding or
+           subtracting the hash of an index.
+  */
+  static std::uint64_t hash_of(size_type idx) {
+    return mix64(static_cast<std::uint64_t>(idx));
+  }
+
+  /**
+    @param hash the hash of the index set
+    @param size the number of indices in the set
+    @param contains contains(idx) is true iff idx is in the set
+    @return the cached entry or an empty pointer
+  */
+  template <class Contains>
+  entry_ptr find(std::uint64_t hash, std::size_t size,
+                 Contains const& contains) {
+    auto & s = get_shard(hash);
+    entry_ptr r;
+    {
+      tbb::spin_mutex::scoped_lock lock(s.mutex);
+      r = find(s, hash, size, contains);
+    }
+    (r ? _hits : _misses).fetch_add(1, std::memory_order_relaxed);
+    return r;
+  }
+
+  /**
+    @brief caches a copy of the factorization qr of the affine hull with the
+           given (distinct) members and hash, unless there is already one
+  */
+  template <class Iterator>
+  void insert(std::uint64_t hash, Iterator members_begin,
+              Iterator members_end, qr_type const& qr) {
+    auto & s = get_shard(hash);
+    entry_ptr e(new entry{std::vector<size_type>(members_begin, members_end),
+                          qr});
+    std::size_t const e_bytes = bytes(*e);
+    auto const& members = e->members;
+    auto const contains = [&members] (size_type idx) {
+      return members.end() != std::find(members.begin(), members.end(), idx);
+    };
+    tbb::spin_mutex::scoped_lock lock(s.mutex);
+    if (find(s, hash, members.size(), contains))
+      return;
+    s.fifo.emplace_back(hash, e.get());
+    s.map.emplace(hash, std::move(e));
+    _insertions.fetch_add(1, std::memory_order_relaxed);
+    _bytes.fetch_add(e_bytes, std::memory_order_relaxed);
+    while (s.fifo.size() > _shard_capacity) {
+      auto range = s.map.equal_range(s.fifo.front().first);
+      while (range.first->second.get() != s.fifo.front().second)
+        ++range.first;
+      assert(range.first != range.second);
+      _bytes.fetch_sub(bytes(*range.first->second),
+                       std::memory_order_relaxed);
+      s.map.erase(range.first);
+      s.fifo.pop_front();
+      _evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  qr_cache_statistics statistics() const {
+    qr_cache_statistics r;
+    r.hits = _hits.load();
+    r.misses = _misses.load();
+    r.insertions = _insertions.load();
+    r.evictions = _evictions.load();
+    r.size = r.insertions - r.evictions;
+    r.bytes = _bytes.load();
+    return r;
+  }
+
+private:
+  shard & get_shard(std::uint64_t hash) {
+    return _shards[hash % _shards.size()];
+  }
+
+  template <class Contains>
+  static entry_ptr find(shard const& s, std::uint64_t hash, std::size_t size,
+                        Contains const& contains) {
+    auto const range = s.map.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      auto const& members = it->second->members;
+      if (members.size() == size &&
+          std::all_of(members.begin(), members.end(), contains))
+        return it->second;
+    }
+    return entry_ptr();
+  }
+
+  static std::size_t bytes(entry const& e) {
+    // the (thin) Q and R both have at most num_rows * num_cols entries
+    return sizeof(entry) + e.members.capacity() * sizeof(size_type) +
+           2 * e.qr.num_rows() * e.qr.num_cols() * sizeof(number_type);
+  }
+
+  std::vector<shard>       _shards;
+  std::size_t const        _shard_capacity;
+  std::atomic<std::size_t> _hits;
+  std::atomic<std::size_t> _misses;
+  std::atomic<std::size_t> _insertions;
+  std::atomic<std::size_t> _evictions;
+  std::atomic<std::size_t> _bytes;
+};
+
+}  // namespace FC
+
+#endif  // QR_CACHE_HPP_
@@ -0,0 +1,92 @@
+#ifndef RANDOM_HPP_
+#define RANDOM_HPP_
+
+#include <cstdint>
+
+#include <random>
+
+namespace FC {
+
+/**
+  @brief the finalizer of SplitMix64, a bijective mixing function
+*/
+inline std::uint64_t mix64(std::uint64_t z) {
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/**
+  @brief A counter-based random number generator: the i-th number of stream s
+         is a hash (the finalizer of SplitMix64) of the seed, s and i.
+         Different streams of the same seed are independent, the state
+         consists of two integers only and seeding is free. Every initial
+         ascend task gets a stream of its own, hence its start does not
+         depend on the worker that creates or runs it.
+*/
+class counter_rng {
+public:
+  typedef std::uint64_t result_type;
+
+  counter_rng(std::uint64_t seed, std::uint64_t stream)
+    : _key(mix64(mix64(seed) + stream * golden_gamma)), _counter(0) {
+  }
+
+  static constexpr result_type min() {
+    return 0;
+  }
+
+  static constexpr result_type max() {
+    return ~result_type(0);
+  }
+
+  result_type operator()() {
+    return mix64(_key + golden_gamma * ++_counter);
+  }
+
+private:
+  static constexpr std::uint64_t golden_gamma = 0x9e3779b97f4a7c15ULL;
+
+  std::uint64_t _key;
+  std::uint64_t _counter;
+};
+
+/**
+  @return a uniformly distributed integer in [0, n), for n > 0. Unlike
+          std::uniform_int_distribution, the mapping is the same for all
+          standard libraries, so a seed places the tasks alike everywhere.
+*/
+template <typename Int>
+Int uniform_index(counter_rng & rng, Int n) {
+  // rejects the lowest values that would make the remainder biased
+  std::uint64_t const bound = std::uint64_t(n);
+  std::uint64_t const threshold = (0 - bound) % bound;
+  std::uint64_t r;
+  do {
+    r = rng();
+  } while (r < threshold);
+  return static_cast<Int>(r % bound);
+}
+
+/**
+  @return a uniformly distributed number in [lo, hi), from the upper 53 bits
+          of a random number like std::generate_canonical<double, 53>, but
+          the same for all standard libraries
+*/
+template <typename Float>
+Float uniform_real(counter_rng & rng, Float lo, Float hi) {
+  Float const u = Float(rng() >> 11) * Float(1.0 / 9007199254740992.0);
+  return lo + u * (hi - lo);
+}
+
+/**
+  @return a non-deterministic seed
+*/
+inline std::uint64_t random_seed() {
+  std::random_device rd;
+  return (std::uint64_t(rd()) << 32) | std::uint64_t(rd());
+}
+
+}  // namespace FC
+
+#endif  // RANDOM_HPP_
@@ -0,0 +1,136 @@
+#ifndef REGION_HPP_
+#define REGION_HPP_
+
+#include <cstddef>
+
+#include <unordered_set>
+#include <vector>
+
+#include <Eigen/Core>
+#include <glog/logging.h>
+
+#include "flow_complex.hpp"
+#include "point_cloud.hpp"
+
+namespace FC {
+
+/**
+  @brief The axis-parallel box of interest of a computation that is
+         restricted to a region, see compute_options::region_min. A box
+         without corners is unbounded, i.e. it is the whole space.
+*/
+template <typename _number_type>
+class region_box {
+public:
+  typedef _number_type                                  number_type;
+  typedef Eigen::Matrix<number_type, Eigen::Dynamic, 1> eigen_vector;
+
+  region_box(std::size_t dim, std::vector<double> const& lo,
+             std::vector<double> const& hi)
+    : _lo(lo.size()), _hi(hi.size()) {
+    CHECK(lo.size() == hi.size()) << "the corners of the region differ in "
+                                     "their dimensions";
+    CHECK(lo.empty() || lo.size() == dim) << "the region is not of the "
+                                             "dimension of the points";
+    for (std::size_t i = 0; i < lo.size(); ++i) {
+      CHECK(lo[i] <= hi[i]) << "the region is empty";
+      _lo[i] = number_type(lo[i]);
+      _hi[i] = number_type(hi[i]);
+    }
+  }
+
+  bool bounded() const {
+    return 0 != _lo.size();
+  }
+
+  eigen_vector center() const {
+    return number_type(0.5) * (_lo + _hi);
+  }
+
+  template <class Derived>
+  bool contains(Eigen::MatrixBase<Derived> const& x) const {
+    return !bounded() ||
+           ((_lo.array() <= x.array()).all() && (x.array() <= _hi.array()).all());
+  }
+
+  /**
+    @return whether the ball around center with the squared radius sq_radius
+            meets the box
+  */
+  template <class Derived>
+  bool meets(Eigen::MatrixBase<Derived> const& center,
+             number_type sq_radius) const {
+    if (!bounded())
+      return true;
+    number_type sq_dist(0);
+    for (std::size_t i = 0; i < std::size_t(_lo.size()); ++i) {
+      if (center[i] < _lo[i])
+        sq_dist += (_lo[i] - center[i]) * (_lo[i] - center[i]);
+      else if (center[i] > _hi[i])
+        sq_dist += (center[i] - _hi[i]) * (center[i] - _hi[i]);
+    }
+    return sq_dist <= sq_radius;
+  }
+
+private:
+  eigen_vector _lo;
+  eigen_vector _hi;
+};
+
+/**
+  @brief removes the critical points whose circumcenters lie outside the
+         region, and the incidences with them, except for the ones with the
+         maximum at infinity.
+  @param keep_boundary if true, the critical points outside that are incident
+                       to ones inside are kept as well, with only their
+                       incidences into the region. Hence the results of
+                       adjacent regions can be merged.
+*/
+template <class PointCloud>
+void restrict_to_region(flow_complex<typename PointCloud::number_type,
+                                     typename PointCloud::size_type> & fc,
+                        PointCloud const& pc,
+                        region_box<typename PointCloud::number_type> const& region,
+                        bool keep_boundary = false) {
+  using cp_type = critical_point<typename PointCloud::number_type,
+                                 typename PointCloud::size_type>;
+  std::unordered_set<cp_type const*> inside;
+  for (auto const& cp : fc)
+    if (!cp.is_max_at_inf() &&
+        region.contains(circumcenter(pc, cp.idx_begin(), cp.idx_end())))
+      inside.insert(&cp);
+  std::unordered_set<cp_type const*> boundary;
+  if (keep_boundary) {
+    for (auto & cp : fc) {
+      if (cp.is_max_at_inf())
+        continue;
+      bool const is_inside = inside.count(&cp);
+      for (auto it = cp.succ_begin(); it != cp.succ_end(); ++it) {
+        if (is_inside && !(*it)->is_max_at_inf() && !(*it)->is_cut_off() &&
+            !inside.count(*it))
+          boundary.insert(*it);
+        else if (!is_inside && inside.count(*it))
+          boundary.insert(&cp);
+      }
+    }
+    std::vector<cp_type const*> outer_succs;
+    for (auto & cp : fc) {
+      if (!boundary.count(&cp))
+        continue;
+      outer_succs.clear();
+      for (auto it = cp.succ_begin(); it != cp.succ_end(); ++it)
+        if (!inside.count(*it))
+          outer_succs.push_back(*it);
+      for (auto const* succ : outer_succs)
+        cp.erase(succ);
+    }
+  }
+  erase_if(fc, [&] (cp_type const& cp) {
+    return !cp.is_max_at_inf() && !cp.is_cut_off() && !inside.count(&cp) &&
+           !boundary.count(&cp);
+  });
+}
+
+}  // namespace FC
+
+#endif  // REGION_HPP_
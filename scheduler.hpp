@@ -0,0 +1,500 @@
+#ifndef SCHEDULER_HPP_
+#define SCHEDULER_HPP_
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Core>
+#include <tbb/spin_mutex.h>
+#include <tbb/task_group.h>
+
+namespace FC {
+
+/**
+  @brief Morton (Z-order) codes of points in a box: the coordinates are
+         quantized to a grid over the box and the bits of the cells are
+         interleaved, hence points with close codes tend to be close in
+         space. Points outside of the box are clamped to it.
+*/
+template <typename _number_type>
+class morton_code {
+public:
+  typedef _number_type                                  number_type;
+  typedef Eigen::Matrix<number_type, Eigen::Dynamic, 1> eigen_vector;
+
+  static constexpr std::size_t max_bits = 63;
+
+  morton_code(eigen_vector lo, eigen_vector const& hi)
+    : _lo(std::move(lo)), _scale(_lo.size()),
+      _dims(std::min<std::size_t>(_lo.size(), max_bits)),
+      _bits_per_dim(std::max<std::size_t>(1, max_bits / _dims)) {
+    assert(_lo.size() == hi.size());
+    number_type const num_cells = std::uint64_t(1) << _bits_per_dim;
+    for (typename eigen_vector::Index i = 0; i < _lo.size(); ++i) {
+      number_type const extent = hi[i] - _lo[i];
+      _scale[i] = extent > 0 ? num_cells / extent : 0;
+    }
+  }
+
+  /**
+    @return the number of (low) bits of the codes that are used
+  */
+  std::size_t bits() const {
+    return _dims * _bits_per_dim;
+  }
+
+  template <class Derived>
+  std::uint64_t operator()(Eigen::MatrixBase<Derived> const& x) const {
+    std::uint64_t const max_cell = (std::uint64_t(1) << _bits_per_dim) - 1;
+    std::uint64_t cells[max_bits];
+    for (std::size_t i = 0; i < _dims; ++i) {
+      number_type const c = (x[i] - _lo[i]) * _scale[i];
+      // also maps NaN to the first cell
+      cells[i] = !(c > 0) ? 0 : (c >= max_cell ? max_cell : std::uint64_t(c));
+    }
+    std::uint64_t code = 0;
+    for (std::size_t bit = _bits_per_dim; bit-- > 0;)
+      for (std::size_t i = 0; i < _dims; ++i)
+        code = (code << 1) | ((cells[i] >> bit) & 1);
+    return code;
+  }
+
+private:
+  eigen_vector      _lo;
+  eigen_vector      _scale;
+  std::size_t const _dims;
+  std::size_t const _bits_per_dim;
+};
+
+template <typename _number_type>
+constexpr std::size_t morton_code<_number_type>::max_bits;
+
+/**
+  @brief Parks the idle workers of a scheduler. A worker that found no task
+         waits until ready() holds, and is woken by notify_one() or
+         notify_all() after the state that ready() reads has changed. The
+         state has to be changed by sequentially consistent atomics before
+         the notification.
+*/
+class idle_workers {
+public:
+  idle_workers() : _mutex(), _cv(), _num_waiting(0) {
+  }
+
+  idle_workers(idle_workers const&) = delete;
+  idle_workers & operator=(idle_workers const&) = delete;
+
+  template <class Ready>
+  void wait(Ready const& ready) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    // counted before ready() is checked: a change of the state after the
+    // check is followed by a notification, which waits for the lock
+    _num_waiting.fetch_add(1);
+    _cv.wait(lock, ready);
+    _num_waiting.fetch_sub(1);
+  }
+
+  void notify_one() {
+    if (0 == _num_waiting.load())
+      return;
+    std::lock_guard<std::mutex> lock(_mutex);
+    _cv.notify_one();
+  }
+
+  void notify_all() {
+    if (0 == _num_waiting.load())
+      return;
+    std::lock_guard<std::mutex> lock(_mutex);
+    _cv.notify_all();
+  }
+
+private:
+  std::mutex               _mutex;
+  std::condition_variable  _cv;
+  std::atomic<std::size_t> _num_waiting;
+};
+
+/**
+  @brief A scheduler that keeps tasks in regions of space, which are
+         consecutive ranges of the Morton codes of the task locations.
+         Every worker owns a contiguous range of regions. It keeps working
+         on the region of its previous task as long as that has tasks left,
+         then turns to its own regions, and only then steals from the regions
+         closest to its own ones along the curve. Hence consecutive tasks of
+         a worker tend to touch the same kd-tree nodes and points.
+         Within a region, tasks are processed last in, first out. Workers
+         without a task sleep until one is pushed.
+         Experimental: it has not been shown to be faster than the
+         bounded_scheduler, and takes no checkpoints.
+*/
+template <class Task>
+class locality_scheduler {
+  struct region {
+    region() : mutex(), tasks(), size(0) {
+    }
+
+    tbb::spin_mutex          mutex;
+    std::vector<Task *>      tasks;
+    // to skip empty regions without locking them
+    std::atomic<std::size_t> size;
+  };
+
+public:
+  /**
+    @param code_bits the number of (low) bits of the codes passed to push
+    @param regions_per_worker the number of regions is the power of 2 that is
+                              at least num_workers * regions_per_worker
+  */
+  locality_scheduler(std::size_t num_workers, std::size_t code_bits,
+                     std::size_t regions_per_worker = 16)
+    : _num_workers(std::max<std::size_t>(1, num_workers)),
+      _code_bits(code_bits), _region_bits(0), _regions(), _pending(0),
+      _queued(0), _idle() {
+    while ((std::size_t(1) << _region_bits) <
+           _num_workers * std::max<std::size_t>(1, regions_per_worker))
+      ++_region_bits;
+    _regions.reset(new region[num_regions()]);
+  }
+
+  locality_scheduler(locality_scheduler const&) = delete;
+  locality_scheduler & operator=(locality_scheduler const&) = delete;
+
+  /**
+    @brief adds a task, also from within a running task
+  */
+  void push(std::uint64_t code, Task * t) {
+    auto & r = _regions[region_of(code)];
+    // counted before it can be taken, so that the number of pending tasks
+    // does not drop to zero while their parent is still running
+    _pending.fetch_add(1, std::memory_order_relaxed);
+    _queued.fetch_add(1);
+    {
+      tbb::spin_mutex::scoped_lock lock(r.mutex);
+      r.tasks.push_back(t);
+      r.size.store(r.tasks.size(), std::memory_order_release);
+    }
+    _idle.notify_one();
+  }
+
+  /**
+    @brief runs body(t) for all tasks t, including the ones that are pushed
+           by body, on num_workers workers until no task is left
+  */
+  template <class Body>
+  void run(Body const& body) {
+    tbb::task_group workers;
+    for (std::size_t w = 0; w < _num_workers; ++w)
+      workers.run([this, &body, w] { work(w, body); });
+    workers.wait();
+  }
+
+private:
+  std::size_t num_regions() const {
+    return std::size_t(1) << _region_bits;
+  }
+
+  std::size_t region_of(std::uint64_t code) const {
+    if (_code_bits >= _region_bits)
+      return code >> (_code_bits - _region_bits);
+    return code << (_region_bits - _code_bits);
+  }
+
+  /**
+    @return the first region of worker, the regions are split evenly among
+            the workers, also if their number is no power of 2
+  */
+  std::size_t first_region(std::size_t worker) const {
+    return worker * num_regions() / _num_workers;
+  }
+
+  template <class Body>
+  void work(std::size_t worker, Body const& body) {
+    std::size_t const home = first_region(worker);
+    std::size_t const width = first_region(worker + 1) - home;
+    std::size_t current = home;
+    while (_pending.load(std::memory_order_acquire) > 0) {
+      Task * t = pop(current, home, width);
+      if (!t) {
+        // woken by the next push, or by the last pending task to let the
+        // workers return
+        _idle.wait([this] {
+          return _queued.load() > 0 || 0 == _pending.load();
+        });
+        continue;
+      }
+      _queued.fetch_sub(1);
+      body(t);
+      if (1 == _pending.fetch_sub(1))
+        _idle.notify_all();
+    }
+  }
+
+  /**
+    @param current the region of the previous task, receives the region of
+                   the returned task
+  */
+  Task * pop(std::size_t & current, std::size_t home, std::size_t width) {
+    Task * t = try_pop(current);
+    if (t)
+      return t;
+    for (std::size_t r = home; r < home + width; ++r)
+      if ((t = try_pop(r))) {
+        current = r;
+        return t;
+      }
+    // steal, alternating between the regions below and above the own ones
+    std::size_t const n = num_regions();
+    for (std::size_t k = 1; k <= home || home + width - 1 + k < n; ++k) {
+      if (home + width - 1 + k < n && (t = try_pop(home + width - 1 + k))) {
+        current = home + width - 1 + k;
+        return t;
+      }
+      if (k <= home && (t = try_pop(home - k))) {
+        current = home - k;
+        return t;
+      }
+    }
+    return nullptr;
+  }
+
+  Task * try_pop(std::size_t idx) {
+    auto & r = _regions[idx];
+    if (0 == r.size.load(std::memory_order_acquire))
+      return nullptr;
+    tbb::spin_mutex::scoped_lock lock(r.mutex);
+    if (r.tasks.empty())
+      return nullptr;
+    Task * t = r.tasks.back();
+    r.tasks.pop_back();
+    r.size.store(r.tasks.size(), std::memory_order_release);
+    return t;
+  }
+
+  std::size_t const         _num_workers;
+  std::size_t const         _code_bits;
+  std::size_t               _region_bits;
+  std::unique_ptr<region[]> _regions;
+  std::atomic<std::size_t>  _pending;
+  // the tasks in the regions, counted before they are added and after they
+  // are taken
+  std::atomic<std::size_t>  _queued;
+  idle_workers              _idle;
+};
+
+/**
+  @brief A work-stealing scheduler that keeps the frontier, i.e. the number
+         of tasks that wait for execution, small. Tasks are pushed with a
+         level, and tasks of lower levels are expected to spawn less work.
+         As long as the frontier is within the budget, every worker runs the
+         tasks it spawned last in, first out, and an idle worker steals the
+         oldest task of another worker, which tends to carry the most work.
+         Beyond the budget, workers run and steal the newest tasks of the
+         lowest level first - so that they complete the pending work
+         depth-first and the frontier shrinks before new work is spawned.
+         Workers without a task sleep until one is pushed.
+
+         The budget is a target, not a bound: the waiting tasks separate the
+         part of the complex that is done from the rest, and no order of the
+         tasks keeps that separator from growing with the size of the point
+         cloud. Blocking the workers that push beyond the budget could hold
+         all of them, and running the pushed tasks nested in their parent
+         instead chains up deeply and grows the frontier faster. Hence the
+         budget only switches the order of the tasks, see peak_frontier()
+         for the frontier that was actually reached.
+*/
+template <class Task>
+class bounded_scheduler {
+  typedef std::pair<std::uint64_t, Task *> entry;  // (sequence number, task)
+
+  struct queue {
+    queue() : mutex(), levels(), size(0) {
+    }
+
+    tbb::spin_mutex                 mutex;
+    std::vector<std::deque<entry>>  levels;
+    // to skip empty queues without locking them
+    std::atomic<std::size_t>        size;
+  };
+
+public:
+  /**
+    @param num_levels tasks are pushed with levels 0, ..., num_levels - 1
+    @param budget the number of waiting tasks beyond which the workers
+                  switch to depth-first execution, 0 for no limit
+  */
+  bounded_scheduler(std::size_t num_workers, std::size_t num_levels,
+                    std::size_t budget = 0)
+    : _num_workers(std::max<std::size_t>(1, num_workers)), _budget(budget),
+      _queues(new queue[_num_workers]), _sequence(0), _pending(0),
+      _frontier(0), _peak_frontier(0), _pause(false), _busy(0), _idle() {
+    for (std::size_t w = 0; w < _num_workers; ++w)
+      _queues[w].levels.resize(std::max<std::size_t>(1, num_levels));
+  }
+
+  bounded_scheduler(bounded_scheduler const&) = delete;
+  bounded_scheduler & operator=(bounded_scheduler const&) = delete;
+
+  /**
+    @brief adds a task to the queue of worker, also from within a running
+           task of this worker
+  */
+  void push(Task * t, std::size_t level, std::size_t worker) {
+    auto & q = _queues[worker % _num_workers];
+    _pending.fetch_add(1, std::memory_order_relaxed);
+    std::size_t const frontier = _frontier.fetch_add(1) + 1;
+    std::size_t peak = _peak_frontier.load(std::memory_order_relaxed);
+    while (frontier > peak &&
+           !_peak_frontier.compare_exchange_weak(peak, frontier,
+                                                 std::memory_order_relaxed)) {
+    }
+    std::uint64_t const seq = _sequence.fetch_add(1, std::memory_order_relaxed);
+    {
+      tbb::spin_mutex::scoped_lock lock(q.mutex);
+      q.levels[std::min(level, q.levels.size() - 1)].emplace_back(seq, t);
+      q.size.fetch_add(1, std::memory_order_release);
+    }
+    _idle.notify_one();
+  }
+
+  /**
+    @brief runs body(t, worker) for all tasks t, including the ones that are
+           pushed by body, on num_workers workers until no task is left
+  */
+  template <class Body>
+  void run(Body const& body) {
+    tbb::task_group workers;
+    for (std::size_t w = 0; w < _num_workers; ++w)
+      workers.run([this, &body, w] { work(w, body); });
+    workers.wait();
+  }
+
+  /**
+    @return true if more tasks than the budget wait for execution
+  */
+  bool over_budget() const {
+    return _budget > 0 && _frontier.load(std::memory_order_relaxed) > _budget;
+  }
+
+  /**
+    @return the largest number of tasks that waited for execution at once
+  */
+  std::size_t peak_frontier() const {
+    return _peak_frontier.load();
+  }
+
+  /**
+    @brief Holds the workers once they finished their current tasks, and
+           calls f(waiting) with the tasks that wait for execution, e.g. to
+           take a checkpoint. The workers continue when f returns. May be
+           called from any thread but the workers.
+  */
+  template <class F>
+  void pause(F const& f) {
+    _pause.store(true);
+    while (_busy.load() > 0)
+      std::this_thread::yield();
+    std::vector<Task *> waiting;
+    for (std::size_t w = 0; w < _num_workers; ++w)
+      for (auto const& level : _queues[w].levels)
+        for (auto const& e : level)
+          waiting.push_back(e.second);
+    f(waiting);
+    _pause.store(false);
+    _idle.notify_all();
+  }
+
+private:
+  enum class order {newest, oldest, depth_first};
+
+  template <class Body>
+  void work(std::size_t worker, Body const& body) {
+    while (_pending.load(std::memory_order_acquire) > 0) {
+      // a worker is busy from before it checks for a pause until its task
+      // is done, hence pause() only returns once no task is held
+      _busy.fetch_add(1);
+      Task * t = _pause.load() ? nullptr : pop(worker);
+      if (!t) {
+        _busy.fetch_sub(1);
+        // woken by the next push, by the end of a pause, or by the last
+        // pending task to let the workers return
+        _idle.wait([this] {
+          return !_pause.load() && (_frontier.load() > 0 ||
+                                    0 == _pending.load());
+        });
+        continue;
+      }
+      _frontier.fetch_sub(1);
+      body(t, worker);
+      _busy.fetch_sub(1);
+      if (1 == _pending.fetch_sub(1))
+        _idle.notify_all();
+    }
+  }
+
+  Task * pop(std::size_t worker) {
+    bool const depth_first = over_budget();
+    Task * t = try_pop(_queues[worker], depth_first ? order::depth_first
+                                                    : order::newest);
+    for (std::size_t i = 1; !t && i < _num_workers; ++i)
+      t = try_pop(_queues[(worker + i) % _num_workers],
+                  depth_first ? order::depth_first : order::oldest);
+    return t;
+  }
+
+  Task * try_pop(queue & q, order o) {
+    if (0 == q.size.load(std::memory_order_acquire))
+      return nullptr;
+    tbb::spin_mutex::scoped_lock lock(q.mutex);
+    std::deque<entry> * best = nullptr;
+    for (auto & level : q.levels) {
+      if (level.empty())
+        continue;
+      if (order::depth_first == o) {
+        best = &level;
+        break;
+      }
+      if (!best || (order::newest == o
+                    ? level.back().first > best->back().first
+                    : level.front().first < best->front().first))
+        best = &level;
+    }
+    if (!best)
+      return nullptr;
+    Task * t;
+    if (order::oldest == o) {
+      t = best->front().second;
+      best->pop_front();
+    } else {
+      t = best->back().second;
+      best->pop_back();
+    }
+    q.size.fetch_sub(1, std::memory_order_release);
+    return t;
+  }
+
+  std::size_t const          _num_workers;
+  std::size_t const          _budget;
+  std::unique_ptr<queue[]>   _queues;
+  std::atomic<std::uint64_t> _sequence;
+  std::atomic<std::size_t>   _pending;
+  std::atomic<std::size_t>   _frontier;
+  std::atomic<std::size_t>   _peak_frontier;
+  std::atomic<bool>          _pause;
+  std::atomic<std::size_t>   _busy;
+  idle_workers               _idle;
+};
+
+}  // namespace FC
+
+#endif  // SCHEDULER_HPP_
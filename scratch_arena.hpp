@@ -0,0 +1,46 @@
+#ifndef SCRATCH_ARENA_HPP_
+#define SCRATCH_ARENA_HPP_
+
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "nn_along_ray.hpp"
+#include "point_cloud.hpp"
+
+namespace FC {
+
+/**
+  @brief The temporary buffers of ascend and descend tasks. The scheduler
+         owns one arena per worker for the lifetime of the computation and
+         hands it to every task it executes, hence tasks do not allocate
+         their temporaries.
+*/
+template <class PointCloud>
+struct scratch_arena {
+  typedef PointCloud                                    point_cloud_type;
+  typedef typename point_cloud_type::number_type        number_type;
+  typedef typename point_cloud_type::size_type          size_type;
+  typedef Eigen::Matrix<number_type, Eigen::Dynamic, 1> eigen_vector;
+
+  explicit scratch_arena(point_cloud_type const& pc)
+    : idx_store(pc.size()), nnvec(pc.dim() + 1), driver(pc.dim()),
+      lambda(pc.dim() + 1), ray(pc.dim()), tmp_ray(pc.dim()), nn(pc.dim()),
+      probe(pc) {
+  }
+
+  // candidate indices of the vertex filters, reused for position offsets
+  std::vector<size_type>                  idx_store;
+  // the nearest neighbors along a ray, at most d + 1
+  std::vector<size_type>                  nnvec;
+  eigen_vector                            driver;
+  eigen_vector                            lambda;
+  eigen_vector                            ray;
+  eigen_vector                            tmp_ray;
+  nn_scratch<number_type, size_type>      nn;
+  growing_ball_search<point_cloud_type>   probe;
+};
+
+}  // namespace FC
+
+#endif  // SCRATCH_ARENA_HPP_
@@ -1,17 +1,33 @@
 #ifndef TBB_HPP_
 #define TBB_HPP_
 
-#include <functional>
+#include <cstddef>
+
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <new>
+#include <type_traits>
 #include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+#include <tbb/enumerable_thread_specific.h>
 
 #include "ascend_task.hpp"
 #include "descend_task.hpp"
 #include "flow_complex.hpp"
+#include "scratch_arena.hpp"
 
 namespace FC {
 
+/**
+  @brief A closed variant of the two kinds of tasks. Tasks are dispatched by
+         their kind instead of a virtual call, and the handlers are passed
+         by reference with their static types.
+*/
 template <class point_cloud_t>
-class abstract_task {
+class task_variant {
 public:
   typedef point_cloud_t                            pc_type;
   typedef typename pc_type::number_type        number_type;
@@ -19,45 +35,211 @@ public:
   typedef flow_complex<number_type, size_type>     fc_type;
   typedef ascend_task<pc_type>                     at_type;
   typedef descend_task<pc_type>                    dt_type;
-  typedef std::function<void(at_type &&)>         ath_type;
-  typedef std::function<void(dt_type &&)>         dth_type;
+  typedef scratch_arena<pc_type>                arena_type;
+  typedef Eigen::Matrix<number_type, Eigen::Dynamic, 1> eigen_vector;
+
+  explicit task_variant(at_type && at) : _kind(kind::ascend) {
+    new (&_storage) at_type(std::move(at));
+  }
+
+  explicit task_variant(dt_type && dt) : _kind(kind::descend) {
+    new (&_storage) dt_type(std::move(dt));
+  }
+
+  task_variant(task_variant const&) = delete;
+  task_variant & operator=(task_variant const&) = delete;
+
+  ~task_variant() {
+    if (kind::ascend == _kind)
+      as_ascend().~at_type();
+    else
+      as_descend().~dt_type();
+  }
+
+  /**
+    @param acih, dcih the circumsphere identity handlers of ascend and
+                      descend tasks, respectively
+  */
+  template <class ATHandler, class DTHandler, class ACIHandler,
+            class DCIHandler>
+  void execute(ATHandler & ath, DTHandler & dth, fc_type & fc,
+               ACIHandler & acih, DCIHandler & dcih, arena_type & arena) {
+    if (kind::ascend == _kind)
+      as_ascend().execute(ath, dth, fc, acih, arena);
+    else
+      as_descend().execute(ath, dth, fc, dcih, arena);
+  }
+
+  eigen_vector const& location() const {
+    return kind::ascend == _kind ? as_ascend().location()
+                                 : as_descend().location();
+  }
+
+  /**
+    @brief writes the kind and the state of the task to os, see load()
+  */
+  void save(std::ostream & os) const {
+    if (kind::ascend == _kind) {
+      os << 'a';
+      as_ascend().save(os);
+    } else {
+      os << 'd';
+      as_descend().save(os);
+    }
+  }
+
+  /**
+    @brief restores a task written by save()
+    @return the task, allocated from pool, or null if is holds no more tasks
+  */
+  template <class Pool>
+  static task_variant * load(std::istream & is, pc_type const& pc,
+                             fc_type & fc, Pool & pool,
+                             typename affine_hull<pc_type>::cache_type * cache) {
+    char k = 0;
+    if (!(is >> k))
+      return nullptr;
+    CHECK('a' == k || 'd' == k) << "unknown kind of task " << k;
+    if ('a' == k)
+      return pool.create(at_type(pc, is, cache));
+    return pool.create(dt_type(pc, fc, is, cache));
+  }
+
+  /**
+    @return the squared radius of the ball around location() whose boundary
+            passes through the affine hull of the task
+  */
+  number_type sq_radius() const {
+    auto const& ah = kind::ascend == _kind ? as_ascend().hull()
+                                           : as_descend().hull();
+    return (location() - ah.pc()[*ah.begin()]).squaredNorm();
+  }
+
+  bool is_descend() const {
+    return kind::descend == _kind;
+  }
+
+  /**
+    @return the size of the affine hull of a descend task, or d + 1 for an
+            ascend task, which may spawn the descends of a maximum
+  */
+  size_type level() const {
+    return kind::ascend == _kind ? as_ascend().hull().pc().dim() + 1
+                                 : as_descend().hull().size();
+  }
+
+private:
+  enum class kind : unsigned char {ascend, descend};
+
+  at_type & as_ascend() {
+    return *reinterpret_cast<at_type *>(&_storage);
+  }
+
+  dt_type & as_descend() {
+    return *reinterpret_cast<dt_type *>(&_storage);
+  }
+
+  at_type const& as_ascend() const {
+    return *reinterpret_cast<at_type const*>(&_storage);
+  }
 
-  virtual void execute(ath_type ath, dth_type dth, fc_type & fc) = 0;
-  
-  virtual ~abstract_task() {
+  dt_type const& as_descend() const {
+    return *reinterpret_cast<dt_type const*>(&_storage);
   }
+
+  kind                                                    _kind;
+  typename std::aligned_union<0, at_type, dt_type>::type  _storage;
 };
 
-template <class task_t, class cih_type>
-class tbb_task_wrapper : public abstract_task<typename task_t::point_cloud_type> {
+/**
+  @brief Pooled storage for objects of type T: every worker keeps an
+         intrusive free list of nodes, which are allocated in chunks and
+         only released when the pool is destroyed. A node is returned to the
+         free list of the worker that destroys the object, which need not be
+         the one that created it.
+*/
+template <class T>
+class task_pool {
+  union node {
+    node *                                                    next;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type value;
+  };
+
+  struct free_list {
+    node *                               head = nullptr;
+    std::vector<std::unique_ptr<node[]>> chunks;
+  };
+
 public:
-  typedef typename task_t::point_cloud_type  pc_type;
-  typedef abstract_task<pc_type>              base_t;
-  typedef typename base_t::ath_type         ath_type;
-  typedef typename base_t::dth_type         dth_type;
-  typedef typename base_t::fc_type           fc_type;
+  explicit task_pool(std::size_t chunk_size = 256)
+    : _chunk_size(chunk_size), _lists() {
+  }
 
-  tbb_task_wrapper(task_t task,  cih_type & cih)
-  : _task(std::move(task)), _cih(cih) {
+  task_pool(task_pool const&) = delete;
+  task_pool & operator=(task_pool const&) = delete;
+
+  template <class... Args>
+  T * create(Args &&... args) {
+    auto & list = _lists.local();
+    if (!list.head)
+      grow(list);
+    node * n = list.head;
+    list.head = n->next;
+    return new (&n->value) T(std::forward<Args>(args)...);
   }
 
-  virtual void execute(ath_type ath, dth_type dth, fc_type & fc) {
-    _task.execute(ath, dth, fc, _cih);
+  void destroy(T * t) {
+    t->~T();
+    node * n = reinterpret_cast<node *>(t);
+    auto & list = _lists.local();
+    n->next = list.head;
+    list.head = n;
   }
 
 private:
-  task_t     _task;
-  cih_type &  _cih;
+  void grow(free_list & list) {
+    list.chunks.emplace_back(new node[_chunk_size]);
+    node * chunk = list.chunks.back().get();
+    for (std::size_t i = 0; i + 1 < _chunk_size; ++i)
+      chunk[i].next = &chunk[i + 1];
+    chunk[_chunk_size - 1].next = list.head;
+    list.head = chunk;
+  }
+
+  std::size_t const                            _chunk_size;
+  tbb::enumerable_thread_specific<free_list>   _lists;
 };
 
-template <class task_t, class cih_t>
-abstract_task<typename task_t::point_cloud_type> *
-make_task_wrapper(task_t task, cih_t & cih) {
-  using wrapper_t = tbb_task_wrapper<task_t, cih_t>;
-  return new wrapper_t(std::move(task), cih);
+/**
+  @brief Executes task and returns it to the pool. Its descend tasks are
+         allocated from the pool and handed to spawn. Ascend tasks are only
+         handed over by descend tasks that found a d-1 critical point, as
+         their very last action - so they run right away, on the same worker
+         and arena, instead of being spawned. Unless defer_ascends() is
+         true: then they are spawned as well, since they may find a maximum
+         and spawn its descends.
+*/
+template <class Task, class Spawn, class Defer, class ACIHandler,
+          class DCIHandler>
+void execute_task(Task * task, Spawn const& spawn, Defer const& defer_ascends,
+                  task_pool<Task> & pool, typename Task::fc_type & fc,
+                  ACIHandler & acih, DCIHandler & dcih,
+                  typename Task::arena_type & arena) {
+  using at_type = typename Task::at_type;
+  using dt_type = typename Task::dt_type;
+  auto dth = [&] (dt_type && dt) {spawn(pool.create(std::move(dt)));};
+  auto no_ath = [] (at_type &&) {};
+  auto ath = [&] (at_type && at) {
+    if (defer_ascends()) {
+      spawn(pool.create(std::move(at)));
+      return;
+    }
+    at.execute(no_ath, dth, fc, acih, arena);
+  };
+  task->execute(ath, dth, fc, acih, dcih, arena);
+  pool.destroy(task);
 }
 
-}
+}  // namespace FC
 
 #endif  // TBB_HPP_
-
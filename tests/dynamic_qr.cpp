@@ -90,6 +90,15 @@ int main() {
   dyn_qr.solve(b, x);
   eigen_vector const static_sol = static_mat.householderQr().solve(b);
   assert(static_sol.isApprox(x));
-  
+
+  // rank-one update with u in the column space, i.e. Q keeps its columns
+  eigen_vector const u_in_span = static_mat * eigen_vector::Random(NUM_COLS);
+  dyn_qr.rank_one_update(u_in_span, v);
+  static_mat += u_in_span * v.transpose();
+  dyn_qr.solve(b, x);
+  eigen_vector const static_sol2 = static_mat.householderQr().solve(b);
+  assert(static_sol2.isApprox(x));
+  assert(dyn_qr.num_cols() == NUM_COLS);
+
   std::exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,47 @@
+#include <cassert>
+#include <cstdlib>
+
+#include <algorithm>
+#include <random>
+#include <set>
+#include <sstream>
+#include <vector>
+
+#include "fingerprint_set.hpp"
+
+using namespace FC;
+
+using size_type = int;
+
+// TODO convert to CATCH
+
+int main() {
+  // a fingerprint set answers like an exact set of the same index sets
+  fingerprint_set<size_type> fps(4);
+  std::set<std::vector<size_type>> exact;
+  std::mt19937 gen(1);
+  std::uniform_int_distribution<size_type> idx_dist(0, 200);
+  for (int i = 0; i < 100000; ++i) {
+    std::vector<size_type> key(1 + i % 4);
+    for (auto & idx : key)
+      idx = idx_dist(gen);
+    std::sort(key.begin(), key.end());
+    bool const is_new = exact.insert(key).second;
+    assert(fps.insert(key.begin(), key.end()) == is_new);
+  }
+  assert(fps.statistics().size == exact.size());
+
+  // a set restored from a checkpoint knows the same index sets, also with a
+  // different number of shards
+  std::stringstream state;
+  fps.save(state);
+  fingerprint_set<size_type> restored(7);
+  restored.load(state);
+  assert(restored.statistics().size == exact.size());
+  for (auto const& key : exact)
+    assert(!restored.insert(key.begin(), key.end()));
+  std::vector<size_type> const fresh{201, 202};
+  assert(restored.insert(fresh.begin(), fresh.end()));
+
+  std::exit(EXIT_SUCCESS);
+}
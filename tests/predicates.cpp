@@ -0,0 +1,78 @@
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+
+#include <Eigen/Core>
+
+#include "predicates.hpp"
+
+using namespace FC;
+
+using number_type = double;
+
+// TODO convert to CATCH
+
+int main() {
+  using eigen_vector = Eigen::Matrix<number_type, Eigen::Dynamic, 1>;
+
+  // expansions are exact: (1 + 2^-60) - 1 - 2^-60 == 0
+  {
+    number_type const tiny = std::ldexp(number_type(1), -60);
+    expansion<number_type> e;
+    e.add(1);
+    e.add(tiny);
+    e.add(-1);
+    assert(e.sign() == 1);
+    e.add(-tiny);
+    assert(e.sign() == 0);
+  }
+
+  // the compensated sum recovers what plain summation loses
+  {
+    number_type const tiny = std::ldexp(number_type(1), -60);
+    accurate_sum<number_type> s;
+    s.add(1);
+    s.add(tiny);
+    s.add(-1);
+    assert(s.value() == tiny);
+  }
+
+  // ray from x = 0 along v = e_0, p on the boundary of the ball at x
+  eigen_vector x = eigen_vector::Zero(2);
+  eigen_vector v = eigen_vector::Zero(2);
+  v[0] = 1;
+  eigen_vector p(2);
+  p << -1, 0;
+  auto const pred = make_ray_predicates(x, v, p);
+  auto const eval = [&pred](eigen_vector const& q) {
+    return pred.eval(q, 0, q[0], q.dot(q));
+  };
+
+  // q = (1, 1) stops the ray at t = 0.25, q = (2, 0) at t = 0.5
+  eigen_vector q1(2), q2(2), q3(2), q4(2);
+  q1 << 1, 1;
+  q2 << 2, 0;
+  // q3 is behind the ray, q4 is on the boundary for t = infinity
+  q3 << -2, 0;
+  q4 << -1, 1;
+  auto const a1 = eval(q1), a2 = eval(q2), a3 = eval(q3), a4 = eval(q4);
+  assert(pred.den_sign(a1) < 0 && pred.t_sign(a1) > 0);
+  assert(pred.t_sign(a2) > 0);
+  assert(pred.t_sign(a3) < 0);
+  assert(pred.den_sign(a4) == 0);
+  assert(pred.compare(a1, a2) < 0);
+  assert(pred.compare(a2, a1) > 0);
+
+  // the mirror image of q1 ties exactly
+  eigen_vector q1m(2);
+  q1m << 1, -1;
+  assert(pred.compare(a1, eval(q1m)) == 0);
+
+  // perturbing q1 below the resolution of the floating-point evaluation of t
+  // must still be ordered correctly
+  eigen_vector q1p = q1;
+  q1p[1] = std::nextafter(q1[1], number_type(2));
+  assert(pred.compare(a1, eval(q1p)) < 0);
+
+  std::exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,65 @@
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+
+#include <atomic>
+#include <vector>
+
+#include <tbb/task_arena.h>
+
+#include "scheduler.hpp"
+
+using namespace FC;
+
+// a task spawns two children until it reaches the depth 0
+struct task {
+  std::uint64_t code;
+  int           depth;
+};
+
+template <class Push>
+void run_task(task * t, Push const& push, std::vector<task> & tasks,
+              std::atomic<std::size_t> & num_run) {
+  num_run.fetch_add(1);
+  if (t->depth > 0)
+    for (int i = 0; i < 2; ++i)
+      push(&tasks[2 * (t - tasks.data()) + 1 + i]);
+}
+
+int main() {
+  // a complete binary tree of tasks, stored in heap order
+  int const depth = 12;
+  std::vector<task> tasks((std::size_t(1) << (depth + 1)) - 1);
+  for (std::size_t i = 0, d = 0; i < tasks.size(); ++i) {
+    if (i + 2 > (std::size_t(2) << d))
+      ++d;
+    tasks[i].code = (i * 2654435761u) & 0xffff;
+    tasks[i].depth = depth - int(d);
+  }
+
+  // also a number of workers that is no power of 2 runs every task once
+  for (std::size_t num_workers : {1, 3, 5}) {
+    tbb::task_arena arena(static_cast<int>(num_workers));
+    std::atomic<std::size_t> num_run(0);
+    arena.execute([&] {
+      locality_scheduler<task> scheduler(num_workers, 16);
+      auto push = [&] (task * t) {scheduler.push(t->code, t);};
+      push(&tasks[0]);
+      scheduler.run([&] (task * t) {run_task(t, push, tasks, num_run);});
+    });
+    assert(num_run.load() == tasks.size());
+
+    num_run.store(0);
+    arena.execute([&] {
+      bounded_scheduler<task> scheduler(num_workers, 1, 8);
+      scheduler.push(&tasks[0], 0, 0);
+      scheduler.run([&] (task * t, std::size_t worker) {
+        run_task(t, [&] (task * c) {scheduler.push(c, 0, worker);}, tasks,
+                 num_run);
+      });
+    });
+    assert(num_run.load() == tasks.size());
+  }
+
+  std::exit(EXIT_SUCCESS);
+}
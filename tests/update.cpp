@@ -0,0 +1,98 @@
+#include <cassert>
+#include <cstdlib>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "clean.hpp"
+#include "compute.hpp"
+#include "update.hpp"
+
+using namespace FC;
+
+using number_type = double;
+using size_type = int;
+using fc_type = flow_complex<number_type, size_type>;
+using point = std::vector<number_type>;
+
+// the critical points by their supports, each with the supports of its
+// successors, where the maximum at infinity has the empty support
+using signature = std::map<std::vector<size_type>,
+                           std::set<std::vector<size_type>>>;
+
+signature signature_of(fc_type const& fc) {
+  auto const support = [] (fc_type::cp_type const& cp) {
+    return cp.is_max_at_inf() ? std::vector<size_type>()
+                              : std::vector<size_type>(cp.idx_begin(),
+                                                       cp.idx_end());
+  };
+  signature r;
+  for (auto const& cp : fc) {
+    auto & succs = r[support(cp)];
+    for (auto it = cp.succ_begin(); it != cp.succ_end(); ++it)
+      succs.insert(support(**it));
+  }
+  return r;
+}
+
+int main() {
+  std::mt19937 gen(1);
+  std::uniform_real_distribution<number_type> coord(0, 1);
+  compute_options options;
+  options.num_threads = 1;
+  options.seed = 1;
+  int num_failed = 0;
+  for (int round = 0; round < 40; ++round) {
+    int const dim = 2 + round % 2;
+    std::vector<point> old_points(100, point(dim));
+    for (auto & p : old_points)
+      for (auto & x : p)
+        x = coord(gen);
+    auto const old_fc = compute_flow_complex<size_type>(
+        old_points.begin(), old_points.end(), dim, options);
+    // remove a few points, insert a few. In every other pair of rounds they
+    // are amidst the points, in the others anywhere, also outside the convex
+    // hull of the old points.
+    bool const inner = round % 4 < 2;
+    auto const is_inner = [] (point const& p) {
+      return std::all_of(p.begin(), p.end(), [] (number_type x) {
+        return 0.3 < x && x < 0.7;
+      });
+    };
+    std::vector<size_type> removed;
+    for (size_type i = 0; i < size_type(old_points.size()); ++i)
+      if (0 == gen() % 10 && (!inner || is_inner(old_points[i])))
+        removed.push_back(i);
+    std::vector<point> new_points;
+    for (size_type i = 0; i < size_type(old_points.size()); ++i)
+      if (!std::binary_search(removed.begin(), removed.end(), i))
+        new_points.push_back(old_points[i]);
+    for (int k = 0; k < 3; ++k) {
+      point p(dim);
+      for (auto & x : p)
+        x = inner ? 0.4 * coord(gen) + 0.3 : 1.4 * coord(gen) - 0.2;
+      new_points.push_back(p);
+    }
+    auto updated = update_flow_complex<size_type>(
+        old_fc, new_points.begin(), new_points.end(), dim, removed, options);
+    auto full = compute_flow_complex<size_type>(
+        new_points.begin(), new_points.end(), dim, options);
+    // a few starts of the full computation miss parts of the complex
+    if (!validate(full))
+      continue;
+    bool const same = signature_of(clean_incidences(std::move(updated))) ==
+                      signature_of(clean_incidences(std::move(full)));
+    if (!same) {
+      ++num_failed;
+      std::cerr << "round " << round << " differs" << std::endl;
+    }
+  }
+  std::cerr << num_failed << " failed" << std::endl;
+  assert(0 == num_failed);
+  std::exit(EXIT_SUCCESS);
+}
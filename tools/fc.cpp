@@ -1,41 +1,592 @@
+#include <csignal>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 
+#include <algorithm>
+#include <chrono>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <exception>
+#include <map>
+#include <mutex>
+#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include <gflags/gflags.h>
 
+#include "approximate.hpp"
+#include "batch.hpp"
 #include "clean.hpp"
 #include "compute.hpp"
 #include "file_io.hpp"
 #include "flow_complex.hpp"
+#include "partition.hpp"
 
 DEFINE_string(point_cloud, "", "path to file containing a point cloud");
+DEFINE_string(batch, "", "instead of --point_cloud, a directory of point "
+                         "clouds, or a file that lists their paths line by "
+                         "line. They are computed side by side, one per "
+                         "thread, and the results written next to them");
 DEFINE_bool(hist, false, "flag to toggle a print of the histogram of"
                          " computed critical points");
 DEFINE_int32(num_threads, -1, "number of threads to use");
 DEFINE_bool(bench, false, "only compute, but don't write to disk");
+DEFINE_int64(seed, -1, "seed for placing the initial ascend tasks, runs with "
+                       "the same seed and number of threads start identically."
+                       " If negative, a random seed is used");
+DEFINE_uint64(frontier_budget, 0, "number of waiting tasks beyond which the "
+                                  "workers execute depth-first, to keep "
+                                  "memory low. A target, not a bound. 0 "
+                                  "means no limit");
+DEFINE_int32(max_index, -1, "compute the critical points up to this index "
+                            "only. If negative, all are computed");
+DEFINE_double(r_max, 0, "follow the flow only up to circumballs of this "
+                        "radius, the critical points beyond are represented "
+                        "by the maximum at infinity. 0 means no limit");
+DEFINE_string(region, "", "comma-separated coordinates of the lower corner, "
+                          "followed by the ones of the upper corner, of a box:"
+                          " compute only the critical points whose "
+                          "circumcenters lie within it");
+DEFINE_int32(partition, 0, "if positive, split the space into this many cells"
+                           " of about the same number of points, compute "
+                           "each cell in a separate process, which share "
+                           "--num_threads, and merge the results");
+DEFINE_string(cell_output, "", "used by --partition: write the critical "
+                               "points of --region, and the ones incident to "
+                               "them across its boundary, cleaned and sorted "
+                               "to this file");
+DEFINE_string(checkpoint, "", "file to which the state of the computation is "
+                              "written periodically, and when it is stopped, "
+                              "see --resume. Removed once it completes");
+DEFINE_double(checkpoint_interval, 600, "seconds between two checkpoints");
+DEFINE_bool(resume, false, "resume the computation from --checkpoint. The "
+                           "other flags should be the ones of the run that "
+                           "wrote it");
+DEFINE_double(time_limit, 0, "seconds after which the computation stops and "
+                             "the critical points found so far are written. "
+                             "0 means no limit. An interrupt (Ctrl-C) stops "
+                             "it as well");
+DEFINE_double(approximate, 0, "if positive, the fraction of the points in a "
+                              "subsample whose flow complex is computed "
+                              "first, and then refined where the other "
+                              "points interfere");
+DEFINE_bool(farthest_point, false, "draw the subsample of --approximate by "
+                                   "farthest-point sampling instead of at "
+                                   "random");
+DEFINE_bool(coarse_only, false, "skip the refinement of --approximate");
+DEFINE_double(refine_radius_factor, 0.5, "refine the critical points of the "
+                                         "subsample of at least this multiple "
+                                         "of its covering radius, 0 for all");
+DEFINE_bool(approximate_reference, false, "also compute the exact flow "
+                                          "complex, and report the share of "
+                                          "its critical points and of its "
+                                          "time of --approximate");
+DEFINE_string(stats, "", "file to which the statistics of the computation, "
+                         "including the counters of the hot paths, are "
+                         "written as JSON. - means stdout");
+
+// cancelled by the first interrupt, the second one terminates right away
+FC::cancellation_token interrupt;
+
+extern "C" void handle_interrupt(int) {
+  interrupt.cancel();
+  std::signal(SIGINT, SIG_DFL);
+}
+
+/**
+  @brief writes the statistics as a JSON object
+*/
+void write_stats(std::ostream & os, FC::compute_statistics const& stats) {
+  os << "{\n"
+     << "  \"peak_frontier\": " << stats.peak_frontier << ",\n"
+     << "  \"pruned_tasks\": " << stats.pruned_tasks << ",\n"
+     << "  \"qr_cache\": {\"hits\": " << stats.qr_cache.hits
+     << ", \"misses\": " << stats.qr_cache.misses
+     << ", \"insertions\": " << stats.qr_cache.insertions
+     << ", \"evictions\": " << stats.qr_cache.evictions
+     << ", \"size\": " << stats.qr_cache.size
+     << ", \"bytes\": " << stats.qr_cache.bytes << "},\n"
+     << "  \"dedup\": {\"size\": " << stats.dedup.size
+     << ", \"collisions\": " << stats.dedup.collisions
+     << ", \"bytes\": " << stats.dedup.bytes << "},\n"
+     << "  \"counters\": {";
+  for (std::size_t i = 0; i < FC::num_metrics; ++i)
+    os << (i ? ",\n" : "\n") << "    \"" << FC::metric_name(FC::metric(i))
+       << "\": " << stats.metrics.values[i];
+  os << "\n  }\n}\n";
+}
+
+/**
+  @brief Runs a process of this program per cell, which computes the
+         critical points whose circumcenters lie in the cell (see --region),
+         and merges their results. There is no halo: as no bound is known on
+         how far the flow reaches, each process reads the whole point cloud,
+         and only the critical points are split. Hence the critical points at
+         the boundary of a cell are the ones of the whole flow complex. Each
+         process cleans the incidences of its cell (see
+         compute_options::region_boundary) and writes them sorted (see
+         write_sorted), the merge streams through these files, such that no
+         process holds more than the critical points of its cell. As the
+         incidences of all cells are kept, one that is redundant only through
+         critical points its cell did not find remains, a few in 10^5 on
+         random clouds.
+  @param args the command line arguments of this process, which are passed
+              on to the processes of the cells. They share --num_threads.
+  @param fc_filename the file the merged flow complex is written to, if not
+                     empty
+  @param num_pending_tasks receives the number of tasks pending in the
+                           cells, see flow_complex::num_pending_tasks
+  @return the histogram of the merged critical points, see compute_hist
+*/
+template <class PointStore>
+std::map<typename PointStore::size_type, int>
+compute_partitioned(PointStore const& ps, std::string const& program,
+                    std::vector<std::string> const& args,
+                    std::string const& fc_filename,
+                    std::size_t & num_pending_tasks) {
+  using size_type = typename PointStore::size_type;
+  auto const cells = FC::spatial_cells(ps.cbegin(), ps.cend(), ps.dim(),
+                                       FLAGS_partition);
+  auto const is_cell_flag = [] (std::string const& arg) {
+    for (std::string const name : {"partition", "region", "cell_output",
+                                   "checkpoint", "num_threads"})
+      for (std::string const prefix : {"-", "--"})
+        if (arg == prefix + name || 0 == arg.find(prefix + name + "="))
+          return true;
+    return false;
+  };
+  std::vector<std::string> common{program};
+  for (std::size_t i = 0; i < args.size(); ++i) {
+    if (!is_cell_flag(args[i]))
+      common.push_back(args[i]);
+    else if (std::string::npos == args[i].find('='))
+      ++i;  // the value follows as the next argument
+  }
+  int num_threads = FLAGS_num_threads;
+  if (num_threads < 0)
+    num_threads = std::thread::hardware_concurrency();
+  int const cell_threads = std::max<int>(1, num_threads / int(cells.size()));
+  // the files of the cells go to a directory of this run, which is removed
+  // with them
+  struct temp_dir {
+    std::string              path;
+    std::vector<std::string> files;
+    ~temp_dir() {
+      for (auto const& file : files)
+        std::remove(file.c_str());
+      if (!path.empty())
+        rmdir(path.c_str());
+    }
+  } tmp;
+  char const* const tmp_base = std::getenv("TMPDIR");
+  std::string const tmp_pattern =
+      std::string(tmp_base && *tmp_base ? tmp_base : "/tmp") + "/fc.XXXXXX";
+  std::vector<char> tmp_path(tmp_pattern.begin(), tmp_pattern.end());
+  tmp_path.push_back('\0');
+  if (!mkdtemp(tmp_path.data()))
+    throw std::runtime_error("could not create a directory " + tmp_pattern);
+  tmp.path = tmp_path.data();
+  bool failed = false;
+  std::vector<pid_t> processes;
+  for (std::size_t i = 0; i < cells.size(); ++i) {
+    std::ostringstream region;
+    region << std::setprecision(17);
+    for (auto const& corner : {cells[i].min, cells[i].max})
+      for (auto const x : corner)
+        region << (region.tellp() > 0 ? "," : "") << x;
+    tmp.files.push_back(tmp.path + "/cell" + std::to_string(i));
+    std::vector<std::string> cell_args = common;
+    cell_args.push_back("--region=" + region.str());
+    cell_args.push_back("--cell_output=" + tmp.files.back());
+    cell_args.push_back("--num_threads=" + std::to_string(cell_threads));
+    // every cell has a checkpoint of its own
+    if (!FLAGS_checkpoint.empty())
+      cell_args.push_back("--checkpoint=" + FLAGS_checkpoint + ".cell" +
+                          std::to_string(i));
+    std::vector<char *> argv;
+    for (auto & arg : cell_args)
+      argv.push_back(&arg[0]);
+    argv.push_back(nullptr);
+    pid_t const pid = fork();
+    if (0 == pid) {
+      execvp(argv[0], argv.data());
+      _exit(127);
+    }
+    if (pid < 0)
+      failed = true;
+    else
+      processes.push_back(pid);
+  }
+  for (auto const pid : processes) {
+    int status;
+    failed |= pid != waitpid(pid, &status, 0) || !WIFEXITED(status) ||
+              0 != WEXITSTATUS(status);
+  }
+  if (failed)
+    throw std::runtime_error("the computation of a cell failed");
+  // every cell lists the critical points in the same order, after the lines
+  // of the maximum at infinity and of the cutoff. The critical points at the
+  // boundaries of the cells are listed repeatedly, their incidences are
+  // merged. The tasks pending in the cells add up.
+  std::ofstream out;
+  if (!fc_filename.empty()) {
+    out.open(fc_filename);
+    if (!out)
+      throw std::runtime_error("could not write to file " + fc_filename);
+  }
+  std::size_t const num_cells = cells.size();
+  std::vector<std::ifstream> in(num_cells);
+  std::vector<std::string> lines(num_cells);
+  std::vector<std::vector<size_type>> keys(num_cells);
+  std::vector<bool> done(num_cells, false);
+  num_pending_tasks = 0;
+  auto const advance = [&] (std::size_t i) {
+    while (std::getline(in[i], lines[i])) {
+      auto const bar = lines[i].find('|');
+      if (0 == lines[i].compare(0, 11, "incomplete ")) {
+        num_pending_tasks += std::stoull(lines[i].substr(11));
+        continue;
+      }
+      if (std::string::npos == bar) {
+        if (0 == i)
+          out << lines[i] << '\n';
+        continue;
+      }
+      keys[i].clear();
+      std::istringstream indices(lines[i].substr(0, bar));
+      for (size_type idx; indices >> idx;)
+        keys[i].push_back(idx);
+      return;
+    }
+    done[i] = true;
+  };
+  for (std::size_t i = 0; i < num_cells; ++i) {
+    in[i].open(tmp.files[i]);
+    if (!in[i])
+      throw std::runtime_error("could not open " + tmp.files[i]);
+    advance(i);
+  }
+  if (num_pending_tasks > 0)
+    out << "incomplete " << num_pending_tasks << '\n';
+  std::map<size_type, int> hist;
+  std::vector<std::string> succs;
+  while (true) {
+    std::size_t least = num_cells;
+    for (std::size_t i = 0; i < num_cells; ++i)
+      if (!done[i] && (num_cells == least || keys[i] < keys[least]))
+        least = i;
+    if (num_cells == least)
+      break;
+    auto const key = keys[least];
+    // the indices and the distance, followed by the successors
+    auto const head_end = lines[least].find('|', lines[least].find('|') + 1);
+    out << lines[least].substr(0, head_end);
+    succs.clear();
+    for (std::size_t i = 0; i < num_cells; ++i) {
+      if (done[i] || keys[i] != key)
+        continue;
+      auto pos = lines[i].find('|', lines[i].find('|') + 1);
+      while (std::string::npos != pos) {
+        auto const next = lines[i].find('|', pos + 1);
+        auto const begin = lines[i].find_first_not_of(' ', pos + 1);
+        auto const end = lines[i].find_last_not_of(' ', next - 1);
+        succs.push_back(lines[i].substr(begin, end + 1 - begin));
+        pos = next;
+      }
+      advance(i);
+    }
+    std::sort(succs.begin(), succs.end());
+    succs.erase(std::unique(succs.begin(), succs.end()), succs.end());
+    for (auto const& succ : succs)
+      out << "| " << succ << " ";
+    out << '\n';
+    ++hist[size_type(key.size()) - 1];
+  }
+  if (!fc_filename.empty() && !out.flush())
+    throw std::runtime_error("could not write to file " + fc_filename);
+  return hist;
+}
+
+/**
+  @return the paths of the point clouds of --batch: the lines of a list, or
+          the files of a directory except for results (*.fc)
+*/
+std::vector<std::string> batch_paths(std::string const& batch) {
+  std::vector<std::string> paths;
+  struct stat info;
+  if (0 == stat(batch.c_str(), &info) && S_ISDIR(info.st_mode)) {
+    DIR * dir = opendir(batch.c_str());
+    if (!dir)
+      throw std::runtime_error("could not open " + batch);
+    while (dirent const* entry = readdir(dir)) {
+      std::string const name = entry->d_name;
+      std::string const path = batch + "/" + name;
+      if (name.size() > 3 && 0 == name.compare(name.size() - 3, 3, ".fc"))
+        continue;
+      if (0 == stat(path.c_str(), &info) && S_ISREG(info.st_mode))
+        paths.push_back(path);
+    }
+    closedir(dir);
+    std::sort(paths.begin(), paths.end());
+  } else {
+    std::ifstream list(batch);
+    if (!list)
+      throw std::runtime_error("could not open " + batch);
+    for (std::string line; std::getline(list, line);)
+      if (!line.empty())
+        paths.push_back(line);
+  }
+  return paths;
+}
+
+/**
+  @brief computes the point clouds of --batch on one pool of threads, see
+         compute_flow_complex_batch, and writes their results next to them
+  @return the exit code, which is not 0 if a cloud failed
+*/
+template <typename float_t, typename size_type>
+int compute_batch(FC::compute_options const& options) {
+  if (!FLAGS_region.empty() || FLAGS_partition > 0 ||
+      !FLAGS_cell_output.empty() || !FLAGS_checkpoint.empty())
+    throw std::runtime_error("--batch cannot be combined with --region, "
+                             "--partition or --checkpoint");
+  auto const paths = batch_paths(FLAGS_batch);
+  std::vector<FC::point_store<float_t, size_type>> clouds(paths.size());
+  for (std::size_t i = 0; i < paths.size(); ++i) {
+    std::ifstream in_file(paths[i]);
+    if (!in_file)
+      throw std::runtime_error("could not open " + paths[i]);
+    in_file >> clouds[i];
+    if (0 == clouds[i].size())
+      throw std::runtime_error("empty data set " + paths[i]);
+  }
+  std::mutex print_mutex;
+  auto const failed = FC::compute_flow_complex_batch<size_type>(
+      clouds.begin(), clouds.end(), options,
+      [&] (std::size_t i, FC::flow_complex<float_t, size_type> fc) {
+    bool const valid = FLAGS_max_index >= 0 || FLAGS_r_max > 0 ||
+                       !fc.is_complete() || FC::validate(fc);
+    {
+      std::lock_guard<std::mutex> lock(print_mutex);
+      if (!fc.is_complete())
+        std::cout << paths[i] << ": warning: the computation was stopped, "
+                     "the flow complex is incomplete\n";
+      if (!valid)
+        std::cout << paths[i] << ": warning: the computed flow complex is "
+                     "not valid\n";
+      if (FLAGS_hist) {
+        std::cout << "** printing histogram of " << paths[i] << " **\n"
+                  << "index\tcount\n";
+        for (const auto& cp_pair : FC::compute_hist(fc))
+          std::cout << cp_pair.first << "\t" << cp_pair.second << "\n";
+      }
+    }
+    fc = clean_incidences(std::move(fc));
+    if (!FLAGS_bench) {
+      auto const fc_filename = paths[i] + ".fc";
+      std::ofstream f(fc_filename);
+      if (!f || !(f << fc))
+        throw std::runtime_error("could not write to file " + fc_filename);
+    }
+  });
+  for (auto const& f : failed) {
+    try {
+      std::rethrow_exception(f.second);
+    } catch (std::exception const& e) {
+      std::cerr << paths[f.first] << ": " << e.what() << std::endl;
+    }
+  }
+  LOG(INFO) << paths.size() - failed.size() << " of " << paths.size()
+            << " point clouds computed";
+  return failed.empty() ? 0 : -1;
+}
+
+/**
+  @brief computes the flow complex of --approximate and reports its quality,
+         optionally in comparison with the exact one
+*/
+template <class PointStore>
+FC::flow_complex<typename PointStore::number_type,
+                 typename PointStore::size_type>
+compute_approximate(PointStore const& ps, FC::compute_options const& options,
+                    FC::compute_statistics * stats) {
+  using size_type = typename PointStore::size_type;
+  if (FLAGS_partition > 0 || !FLAGS_checkpoint.empty())
+    throw std::runtime_error("--approximate cannot be combined with "
+                             "--partition or --checkpoint");
+  FC::approximation_options approximation;
+  approximation.sample_fraction = FLAGS_approximate;
+  approximation.farthest_point = FLAGS_farthest_point;
+  approximation.refine = !FLAGS_coarse_only;
+  approximation.refine_radius_factor = FLAGS_refine_radius_factor;
+  FC::approximation_report report;
+  auto fc = FC::approximate_flow_complex<size_type>(
+      ps.cbegin(), ps.cend(), ps.dim(), options, approximation, &report, stats);
+  double const seconds = report.coarse_seconds + report.refine_seconds;
+  std::cout << "approximation from " << report.sample_size << " samples, "
+            << "covering radius " << report.covering_radius << ": "
+            << report.exact_critical_points << " of "
+            << report.coarse_critical_points << " critical points of the "
+            << "subsample are exact, " << report.coarse_seconds << " s + "
+            << report.refine_seconds << " s refinement of the ones of radius "
+            << report.refine_radius << " and more\n";
+  if (FLAGS_approximate_reference) {
+    auto const start = std::chrono::steady_clock::now();
+    auto const exact = FC::compute_flow_complex<size_type>(
+        ps.cbegin(), ps.cend(), ps.dim(), options);
+    double const exact_seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    // all critical points, and the refined ones
+    std::size_t num_exact[2] = {0, 0}, num_found[2] = {0, 0};
+    auto const sq_refine_radius = report.refine_radius * report.refine_radius;
+    for (auto const& cp : exact) {
+      if (cp.is_max_at_inf() || 0 == cp.index())
+        continue;
+      bool const found = fc.find(cp);
+      for (int large = 0; large < 2; ++large) {
+        if (large && cp.sq_dist() < sq_refine_radius)
+          continue;
+        ++num_exact[large];
+        num_found[large] += found;
+      }
+    }
+    std::cout << "the approximation has " << num_found[0] << " of the "
+              << num_exact[0] << " critical points of the exact flow complex ("
+              << 100.0 * num_found[0] / std::max<std::size_t>(1, num_exact[0])
+              << "%), " << num_found[1] << " of the " << num_exact[1]
+              << " of radius " << report.refine_radius << " and more, in "
+              << 100.0 * seconds / exact_seconds << "% of its time\n";
+  }
+  return fc;
+}
 
 int main(int argc, char ** argv) {
   google::InitGoogleLogging(argv[0]);
+  std::vector<std::string> const args(argv + 1, argv + argc);
   gflags::SetUsageMessage("call with --helpshort parameter for available flags");
   gflags::ParseCommandLineFlags(&argc, &argv, true);
-  CHECK(!FLAGS_point_cloud.empty()) << "point cloud file missing";
+  CHECK(FLAGS_point_cloud.empty() != FLAGS_batch.empty())
+      << "either a point cloud file or a batch is needed";
   try {
     using float_t = long double;
     using size_type = int;
+    FC::compute_options options;
+    options.num_threads = FLAGS_num_threads;
+    options.seed = FLAGS_seed;
+    options.frontier_budget = FLAGS_frontier_budget;
+    options.max_index = FLAGS_max_index;
+    options.r_max = FLAGS_r_max;
+    options.checkpoint = FLAGS_checkpoint;
+    options.checkpoint_interval = FLAGS_checkpoint_interval;
+    options.resume = FLAGS_resume;
+    options.cancel = interrupt;
+    std::signal(SIGINT, handle_interrupt);
+    if (FLAGS_time_limit > 0)
+      options.deadline = std::chrono::steady_clock::now() +
+          std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+              std::chrono::duration<double>(FLAGS_time_limit));
+    if (FLAGS_resume && FLAGS_checkpoint.empty())
+      throw std::runtime_error("--resume needs a --checkpoint");
+    if (!FLAGS_batch.empty())
+      return compute_batch<float_t, size_type>(options);
     std::ifstream in_file(FLAGS_point_cloud);
     if (!in_file)
       throw std::runtime_error("could not open " + FLAGS_point_cloud);
     FC::point_store<float_t, size_type> ps;
     in_file >> ps;
     CHECK (ps.size() > 0) << "empty data sets";
-    auto fc = FC::compute_flow_complex<size_type>(ps.begin(), ps.end(),
-                                                  ps.dim(), FLAGS_num_threads);
-    if (!FC::validate(fc))
+    if (!FLAGS_region.empty()) {
+      std::istringstream coords(FLAGS_region);
+      std::vector<double> corners;
+      for (std::string c; std::getline(coords, c, ',');)
+        corners.push_back(std::stod(c));
+      if (corners.size() != std::size_t(2 * ps.dim()))
+        throw std::runtime_error("the region needs two corners of dimension " +
+                                 std::to_string(ps.dim()));
+      options.region_min.assign(corners.begin(), corners.begin() + ps.dim());
+      options.region_max.assign(corners.begin() + ps.dim(), corners.end());
+    }
+    if (!FLAGS_cell_output.empty()) {
+      if (FLAGS_region.empty())
+        throw std::runtime_error("--cell_output needs a --region");
+      options.region_boundary = true;
+      auto fc = FC::compute_flow_complex<size_type>(ps.begin(), ps.end(),
+                                                    ps.dim(), options);
+      std::ofstream f(FLAGS_cell_output);
+      if (!f || !FC::write_sorted(f, fc))
+        throw std::runtime_error("could not write to file " +
+                                 FLAGS_cell_output);
+      return 0;
+    }
+    if (FLAGS_partition > 0 && !FLAGS_region.empty())
+      throw std::runtime_error("--partition splits the whole space, it "
+                               "cannot be combined with --region");
+    if (FLAGS_partition > 0 && FLAGS_approximate <= 0) {
+      std::size_t num_pending_tasks;
+      auto const hist = compute_partitioned(
+          ps, argv[0], args, FLAGS_bench ? "" : FLAGS_point_cloud + ".fc",
+          num_pending_tasks);
+      if (num_pending_tasks > 0)
+        std::cout << "warning: the computation was stopped with "
+                  << num_pending_tasks << " tasks pending, the flow "
+                     "complex is incomplete\n";
+      else if (FLAGS_max_index < 0 && FLAGS_r_max <= 0 &&
+               !FC::validate(hist))
+        std::cout << "warning: the computed flow complex is not valid. "
+                     "This is probably the result of numerical inaccuracies "
+                     "or degenerate input\n";
+      if (FLAGS_hist) {
+        std::cout << "** printing histogram **" << std::endl;
+        std::cout << "index\tcount" << std::endl;
+        for (const auto& cp_pair : hist)
+          std::cout << cp_pair.first << "\t" << cp_pair.second << std::endl;
+      }
+      return 0;
+    }
+    FC::compute_statistics stats;
+    auto fc = FLAGS_approximate > 0
+        ? compute_approximate(ps, options, &stats)
+        : FC::compute_flow_complex<size_type>(ps.begin(), ps.end(), ps.dim(),
+                                              options, &stats);
+    LOG(INFO) << "peak number of waiting tasks: " << stats.peak_frontier;
+    LOG(INFO) << stats.dedup;
+    if (!FLAGS_region.empty())
+      LOG(INFO) << "tasks outside the region: " << stats.pruned_tasks;
+    if (FLAGS_qr_cache_capacity > 0)
+      std::cout << stats.qr_cache << std::endl;
+    LOG(INFO) << stats.metrics;
+    if ("-" == FLAGS_stats) {
+      write_stats(std::cout, stats);
+    } else if (!FLAGS_stats.empty()) {
+      std::ofstream f(FLAGS_stats);
+      if (!f)
+        throw std::runtime_error("could not write to file " + FLAGS_stats);
+      write_stats(f, stats);
+    }
+    if (!fc.is_complete())
+      std::cout << "warning: the computation was stopped with "
+                << fc.num_pending_tasks() << " tasks pending, the flow "
+                   "complex is incomplete\n";
+    if (FLAGS_r_max > 0)
+      LOG(INFO) << "critical points whose flow was cut off at r_max: "
+                << std::count_if(fc.begin(), fc.end(),
+                     [&fc] (decltype(fc)::cp_type const& cp) {
+                       return cp.succ_end() != std::find(cp.succ_begin(),
+                         cp.succ_end(), fc.max_at_cutoff());
+                     });
+    // the Euler characteristic only adds up for the whole flow complex
+    if (FLAGS_max_index < 0 && FLAGS_r_max <= 0 && FLAGS_region.empty() &&
+        FLAGS_approximate <= 0 && fc.is_complete() && !FC::validate(fc))
       std::cout << "warning: the computed flow complex is not valid. "
                    "This is probably the result of numerical inaccuracies or "
                    "degenerate input\n";
@@ -46,8 +597,10 @@ int main(int argc, char ** argv) {
         std::cout << cp_pair.first << "\t" << cp_pair.second << std::endl;
     }
     std::cout.flush();
-    // cleansing
-    fc = clean_incidences(std::move(fc));
+    // cleansing, which would run past a stop, an incomplete complex is
+    // written as it was found
+    if (fc.is_complete())
+      fc = clean_incidences(std::move(fc));
     // printing
     if (!FLAGS_bench) {
       auto fc_filename = FLAGS_point_cloud + ".fc";
@@ -0,0 +1,317 @@
+#ifndef UPDATE_HPP_
+#define UPDATE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/LU>
+#include <glog/logging.h>
+
+#include "affine_hull.hpp"
+#include "ascend_task.hpp"
+#include "common.hpp"
+#include "compute.hpp"
+#include "descend_task.hpp"
+#include "flow_complex.hpp"
+#include "options.hpp"
+#include "point_cloud.hpp"
+#include "random.hpp"
+#include "tbb.hpp"
+#include "utility.hpp"
+
+namespace FC {
+
+/**
+  @brief Walks from the simplex of the points [begin, end) towards q: while q
+         is beyond a facet, the vertex opposite to it is replaced by the
+         candidate point farthest beyond it, found by a halfspace search.
+  @param is_candidate whether the point of an index spans the hull
+  @return true if q is certified to lie in the interior of a simplex of
+          candidate points, and hence of their convex hull. False if it is
+          beyond a facet that no candidate point is beyond, or if the walk
+          does not end within a few steps per dimension.
+*/
+template <class PointCloud, class Iterator, class Derived, class IsCandidate>
+bool inside_convex_hull(PointCloud const& pc,
+                        Eigen::MatrixBase<Derived> const& q,
+                        Iterator begin, Iterator end,
+                        IsCandidate const& is_candidate) {
+  using size_type = typename PointCloud::size_type;
+  using number_type = typename PointCloud::number_type;
+  using eigen_vector = Eigen::Matrix<number_type, Eigen::Dynamic, 1>;
+  using eigen_matrix = Eigen::Matrix<number_type, Eigen::Dynamic,
+                                     Eigen::Dynamic>;
+  auto const dim = pc.dim();
+  std::vector<size_type> simplex(begin, end);
+  DCHECK(simplex.size() == std::size_t(dim + 1));
+  number_type const margin = Eigen::NumTraits<number_type>::dummy_precision();
+  eigen_matrix edges(dim, dim);
+  eigen_vector lambda(dim + 1);
+  for (int step = 0; step < 16 * (dim + 1); ++step) {
+    for (Eigen::Index k = 1; k <= dim; ++k)
+      edges.col(k - 1) = pc[simplex[k]] - pc[simplex[0]];
+    // the rows are the gradients of the barycentric coordinates 1..dim
+    eigen_matrix const gradients = edges.partialPivLu().inverse();
+    lambda.tail(dim) = gradients * (q - pc[simplex[0]]);
+    lambda[0] = 1 - lambda.tail(dim).sum();
+    if (!lambda.allFinite())
+      return false;
+    Eigen::Index i;
+    if (lambda.minCoeff(&i) > margin)
+      return true;
+    // the outer normal of the facet opposite to vertex i
+    eigen_vector const normal = 0 == i
+        ? eigen_vector(gradients.colwise().sum().transpose())
+        : eigen_vector(-gradients.row(i - 1).transpose());
+    number_type farthest = normal.dot(pc[simplex[0 == i ? 1 : 0]]);
+    size_type next = 0;
+    bool found = false;
+    pc.halfspace_search(normal, farthest, 0, [&] (size_type idx) {
+      if (is_candidate(idx)) {
+        number_type const height = normal.dot(pc[idx]);
+        if (height > farthest) {
+          farthest = height;
+          next = idx;
+          found = true;
+        }
+      }
+      return false;
+    });
+    if (!found)
+      return false;
+    simplex[i] = next;
+  }
+  return false;
+}
+
+/**
+  @brief Updates the flow complex of a point set after points were removed
+         and inserted, and only recomputes where the critical points are
+         affected by the change.
+         The critical points that contain a removed point, or whose
+         circumball contains an inserted point, are dropped along with their
+         incidences - all others stay critical. The new ones are found by
+         ascend tasks that start around the inserted points and the dropped
+         critical points, and by descend tasks from the critical points that
+         are close to the change: the ones that a dropped critical point
+         was incident to, and the ones whose circumball grown by the factor
+         2 contains an inserted point. Their incidences are found anew, the
+         other ones are kept. As tasks stop at critical points that are
+         known already, the work stays confined to the affected region.
+         The incidences with the maximum at infinity are found by flows that
+         leave the convex hull, which no local search repeats. Hence a change
+         that reaches them - a dropped or a descended from critical point is
+         incident to the maximum at infinity or to the cut off flows (see
+         flow_complex::max_at_cutoff), or an inserted point is not
+         certified to be inside the convex hull of the kept points - falls
+         back to compute_flow_complex. Either way the point cloud and its
+         kd-tree are built anew for the new point set, in O(n log n).
+  @param fc the flow complex of the old point set
+  @param begin, end the new point set: the old points without the removed
+                    ones, in their order, followed by the inserted ones
+  @param removed the indices of the removed points in the old point set
+  @param options see compute_options, the seed determines the perturbations
+                 of the starting positions of the ascend tasks
+  @param stats if not null, receives the statistics of the computation
+  @param min_radius if positive, the critical points of smaller radius are
+                    kept although their circumballs contain inserted
+                    points, as approximations, and no ascends start at the
+                    inserted points. The work is confined to the larger
+                    critical points then, see approximate_flow_complex, and
+                    there is no fallback: the incidences with the maximum
+                    at infinity may be stale.
+  @return the flow complex of the new point set
+*/
+template <typename size_type, bool Aligned = false, typename PointIterator,
+          typename dim_type>
+flow_complex<typename base_t<decltype((*PointIterator())[0])>::type,
+             size_type>
+update_flow_complex(
+    flow_complex<typename base_t<decltype((*PointIterator())[0])>::type,
+                 size_type> const& fc,
+    PointIterator begin, PointIterator end, dim_type dim,
+    std::vector<size_type> const& removed, compute_options const& options,
+    compute_statistics * stats = nullptr, double min_radius = 0) {
+  DLOG(INFO) << "*****************UPDATE-START*************************\n";
+  using number_type = typename base_t<decltype((*PointIterator())[0])>::type;
+  using fc_type = flow_complex<number_type, size_type>;
+  using cp_type = typename fc_type::cp_type;
+  using pc_type = point_cloud<number_type, size_type, Aligned>;
+  using at_type = ascend_task<pc_type>;
+  using dt_type = descend_task<pc_type>;
+  using task_type = task_variant<pc_type>;
+  using eigen_vector = Eigen::Matrix<number_type, Eigen::Dynamic, 1>;
+
+  pc_type pc(begin, end, dim);
+  fc_type new_fc(dim, pc.size());
+  new_fc.set_sq_radius_cutoff(fc.sq_radius_cutoff());
+
+  // 1) map the indices of the kept points
+  size_type const num_old = fc.num_minima();
+  std::vector<bool> is_removed(num_old, false);
+  for (auto const idx : removed) {
+    CHECK(std::size_t(idx) < std::size_t(num_old))
+        << "invalid index of a removed point";
+    is_removed[idx] = true;
+  }
+  size_type const no_index = std::numeric_limits<size_type>::max();
+  std::vector<size_type> new_index(num_old);
+  size_type num_kept = 0;
+  for (size_type i = 0; i < num_old; ++i)
+    new_index[i] = is_removed[i] ? no_index : num_kept++;
+  CHECK(num_kept <= pc.size()) << "the new point set lacks kept points";
+  bool const has_inserted = num_kept < pc.size();
+  number_type const sq_min_radius = number_type(min_radius) * min_radius;
+
+  // 2) keep the critical points that stay critical
+  std::vector<size_type> idx_store(pc.size());
+  std::vector<size_type> support;
+  auto const map_support = [&] (cp_type const& cp) {
+    support.clear();
+    for (auto it = cp.idx_begin(); it != cp.idx_end(); ++it)
+      if (!is_removed[*it])
+        support.push_back(new_index[*it]);
+    return support.size() == std::size_t(cp.index() + 1);
+  };
+  // whether the ball at the center of cp, with the squared radius sq_radius,
+  // contains an inserted point
+  auto const contains_inserted = [&] (eigen_vector const& center,
+                                      number_type sq_radius) {
+    auto const idx_end = pc.radius_search(center, sq_radius,
+                                          idx_store.begin());
+    return idx_end != std::find_if(idx_store.begin(), idx_end,
+      [&] (size_type idx) {
+        return idx >= num_kept && (pc[idx] - center).squaredNorm() < sq_radius;
+      });
+  };
+  // the support of a kept maximum, to start the walks to inserted points
+  std::vector<size_type> hull_simplex;
+  bool touches_infinity = false;
+  auto const incident_to_infinity = [] (cp_type const& cp) {
+    return cp.succ_end() != std::find_if(cp.succ_begin(), cp.succ_end(),
+      [] (cp_type const* succ) {
+        return succ->is_max_at_inf() || succ->is_cut_off();
+      });
+  };
+  std::unordered_map<cp_type const*, cp_type *> image;
+  image.emplace(fc.max_at_inf(), new_fc.max_at_inf());
+  image.emplace(fc.max_at_cutoff(), new_fc.max_at_cutoff());
+  std::vector<cp_type const*> dropped;
+  std::vector<eigen_vector> seed_locations;
+  for (auto const& cp : fc) {
+    if (cp.is_max_at_inf())
+      continue;
+    bool keep = map_support(cp);
+    if (keep && cp.index() == pc.dim() && hull_simplex.empty())
+      hull_simplex = support;
+    if (keep && cp.index() > 0 && has_inserted &&
+        cp.sq_dist() >= sq_min_radius) {
+      auto const center = circumcenter(pc, support.begin(), support.end());
+      keep = !contains_inserted(center, cp.sq_dist());
+      if (!keep)
+        seed_locations.push_back(center);
+    }
+    if (!keep) {
+      dropped.push_back(&cp);
+      touches_infinity |= incident_to_infinity(cp);
+      // start an ascend amidst the remaining points of the support
+      if (!support.empty()) {
+        eigen_vector centroid = eigen_vector::Zero(pc.dim());
+        for (auto const idx : support)
+          centroid += pc[idx];
+        seed_locations.push_back(centroid / number_type(support.size()));
+      }
+      continue;
+    }
+    auto * image_cp = new_fc.insert(cp_type(support.begin(), support.end(),
+                                            cp.sq_dist())).second;
+    image.emplace(&cp, image_cp);
+  }
+
+  // 3) find the critical points close to the change
+  std::unordered_set<cp_type *> dirty;
+  for (auto const* cp : dropped)
+    for (auto it = cp->succ_begin(); it != cp->succ_end(); ++it) {
+      auto const succ = image.find(*it);
+      if (image.end() != succ && !succ->second->is_max_at_inf() &&
+          !succ->second->is_cut_off() && succ->second->index() > 1)
+        dirty.insert(succ->second);
+    }
+  if (has_inserted) {
+    for (auto const& el : image) {
+      auto * cp = el.second;
+      if (cp->is_max_at_inf() || cp->is_cut_off() || cp->index() < 2 ||
+          cp->sq_dist() < sq_min_radius)
+        continue;
+      auto const center = circumcenter(pc, cp->idx_begin(), cp->idx_end());
+      if (contains_inserted(center, 4 * cp->sq_dist()))
+        dirty.insert(cp);
+    }
+    if (min_radius <= 0)
+      for (size_type idx = num_kept; idx < pc.size(); ++idx)
+        seed_locations.push_back(pc[idx]);
+  }
+  // the descends from the dirty critical points find their incidences anew
+  for (auto const& el : image)
+    for (auto it = el.first->succ_begin(); it != el.first->succ_end(); ++it) {
+      auto const succ = image.find(*it);
+      if (image.end() != succ && !dirty.count(succ->second))
+        el.second->add_successor(succ->second);
+    }
+  // fall back where the change reaches the flows to infinity
+  if (min_radius <= 0) {
+    for (auto const* cp : dirty)
+      touches_infinity |= incident_to_infinity(*cp);
+    auto const is_kept = [num_kept] (size_type idx) { return idx < num_kept; };
+    for (size_type idx = num_kept; idx < pc.size() && !touches_infinity;
+         ++idx)
+      touches_infinity = hull_simplex.empty() ||
+        !inside_convex_hull(pc, pc[idx], hull_simplex.begin(),
+                            hull_simplex.end(), is_kept);
+    if (touches_infinity) {
+      DLOG(INFO) << "the change reaches the maximum at infinity, recomputing";
+      return compute_flow_complex<size_type, Aligned>(begin, end, dim,
+                                                      options, stats);
+    }
+  }
+  DLOG(INFO) << dropped.size() << " critical points dropped, "
+             << dirty.size() << " to descend from again" << std::endl;
+
+  // 4) recompute, starting at the affected region
+  process_tasks(pc, new_fc, options, stats,
+                [&] (task_pool<task_type> & pool, int,
+                     typename affine_hull<pc_type>::cache_type * cache) {
+    std::vector<task_type *> tasks;
+    auto dth = [&] (dt_type && dt) {tasks.push_back(pool.create(std::move(dt)));};
+    for (auto * cp : dirty) {
+      affine_hull<pc_type> ah(pc, cache);
+      for (auto it = cp->idx_begin(); it != cp->idx_end(); ++it)
+        ah.append_point(*it);
+      std::vector<size_type> pos(ah.size());
+      std::iota(pos.begin(), pos.end(), 0);
+      spawn_sub_descends(dth, new_fc, pos.begin(), pos.end(),
+                         circumcenter(pc, cp->idx_begin(), cp->idx_end()),
+                         std::move(ah), cp);
+    }
+    std::uint64_t const seed = options.seed < 0 ? random_seed() : options.seed;
+    for (std::size_t i = 0; i < seed_locations.size(); ++i) {
+      counter_rng rng(seed, i + 1);
+      tasks.push_back(pool.create(at_type(pc, seed_locations[i], rng, cache)));
+    }
+    return tasks;
+  });
+
+  return new_fc;
+}
+
+}  // namespace FC
+
+#endif  // UPDATE_HPP_
@@ -2,6 +2,9 @@
 #define UTILITY_HPP_
 
 #include <algorithm>
+#include <istream>
+#include <iterator>
+#include <ostream>
 #include <type_traits>
 #include <vector>
 
@@ -90,6 +93,31 @@ TargetType convertSafelyTo(SourceType a) {
   return static_cast<TargetType>(a);
 }
 
+/**
+  @brief writes the length of a range and its elements, separated by spaces.
+         The precision of os has to suffice to read the elements back
+         exactly, see load_range.
+*/
+template <class Iterator>
+void save_range(std::ostream & os, Iterator begin, Iterator end) {
+  os << ' ' << std::distance(begin, end);
+  for (; begin != end; ++begin)
+    os << ' ' << *begin;
+}
+
+/**
+  @brief reads a range written by save_range into c, which may be a
+         std::vector or an Eigen vector
+*/
+template <class Container>
+void load_range(std::istream & is, Container & c) {
+  std::size_t n = 0;
+  is >> n;
+  c.resize(n);
+  for (std::size_t i = 0; i < n; ++i)
+    is >> c[i];
+}
+
 }  // namespace FC
 
 #endif  // UTILITY_HPP_
@@ -4,11 +4,16 @@
 #include <cassert>
 
 #include <algorithm>
-#include <functional>
+#include <iterator>
+#include <memory>
 #include <ostream>
 
 #include <glog/logging.h>
 #include "affine_hull.hpp"
+#include "metrics.hpp"
+#include "point_cloud.hpp"
+#include "predicates.hpp"
+#include "utility.hpp"
 
 namespace FC {
 
@@ -42,38 +47,56 @@ struct vertex_filter {
 
   /**
     @brief for ascend tasks
+    @param probe if not null, it is reset and used for probing, which saves
+                 its allocations
   */
-  template <typename Derived1, typename Derived2, typename Derived3>
+  template <typename Derived1, typename Derived2, typename Derived3,
+            typename IgnoreFn>
   vertex_filter(PointCloud const& pc,
                 Eigen::MatrixBase<Derived1> const& location,
                 Eigen::MatrixBase<Derived2> const& direction,
                 Eigen::MatrixBase<Derived3> const& point_on_sphere,
-                std::function<bool(size_type)> ignoreFn,
-                ResultIterator result_begin)
+                const IgnoreFn& ignoreFn,
+                ResultIterator result_begin,
+                growing_ball_search<PointCloud> * probe = nullptr)
   : _pc(pc), _current(result_begin), _end(result_begin) {
     using number_type = typename Derived1::Scalar;
-    using eigen_vector = Eigen::Matrix<number_type, Eigen::Dynamic, 1>;
     size_type num_iter = 0;
     const number_type sq_diameter = pc.diameter() * pc.diameter();
     number_type sq_radius;
+    number_type step;
+    bool found;
     // probe for candidate stoppers by increasing the probing sphere
-    // exponentially until we exceed the diameter of the dataset
+    // exponentially until we exceed the diameter of the dataset. The probe
+    // only checks for emptiness and resumes from where the previous one left
+    // off, the candidates are only collected for the last probing sphere
+    std::unique_ptr<growing_ball_search<PointCloud>> own_probe;
+    if (probe) {
+      probe->reset();
+    } else {
+      own_probe.reset(new growing_ball_search<PointCloud>(pc));
+      probe = own_probe.get();
+    }
     do {
-      eigen_vector new_location = location + std::exp2(num_iter) * direction;
+      step = std::exp2(num_iter);
+      auto const new_location = location + step * direction;
       sq_radius = (new_location - point_on_sphere).squaredNorm();
-      _end = pc.radius_search(new_location, sq_radius, _current);
-      _end = std::remove_if(_current, _end, ignoreFn);
+      found = !probe->is_empty(new_location, sq_radius, ignoreFn);
       ++num_iter;
-    } while(_end == _current && sq_radius < sq_diameter);
+    } while(!found && sq_radius < sq_diameter);
+    metrics::add(metric::probe_rounds, num_iter);
+    if (found)
+      _end = probe->collect(location + step * direction, sq_radius, ignoreFn,
+                            _current);
     // if we increased the probing sphere all the way to the diameter of the
     // dataset and still didn't find any containing points, it is likely we are
     // on the boundary floating to infinity, but still, it is technically 
     // possible we pick up a point very far outside because of a sliver, so we
-    // have to check all points of the dataset, to be safe
+    // have to search the kd-tree for all points that may stop us, to be safe
     if (_end == _current) {
-      _end = std::next(_current, pc.size());
-      std::iota(_current, _end, 0);
-      _end = std::remove_if(_current, _end, ignoreFn);
+      metrics::add(metric::halfspace_searches);
+      _end = stopper_candidates(pc, location, direction, point_on_sphere,
+                                ignoreFn, _current);
     }
   }
   
@@ -89,7 +112,60 @@ struct vertex_filter {
     return r;
   }
   
+  /**
+    @brief fetches the next candidates at once
+    @param idx_begin receives the indices of at most max_num candidates
+    @return the number of fetched candidates, 0 if there are none left
+  */
+  template <class OutIterator>
+  size_type fetch(OutIterator idx_begin, size_type max_num) {
+    size_type const num = std::min(max_num,
+        convertSafelyTo<size_type>(std::distance(_current, _end)));
+    std::copy_n(_current, num, idx_begin);
+    std::advance(_current, num);
+    return num;
+  }
+  
+  PointCloud const& pc() const {
+    return _pc;
+  }
+  
 private:
+  /**
+    @brief Since the ball at location is empty, a point q stops the ray
+           location + t * direction for some t > 0 iff the denominator
+           v * p - v * q of t is negative, i.e. iff q lies in the open
+           halfspace v * q > v * p. Those points are found by a certified
+           branch-and-bound search of the kd-tree - for flows to infinity,
+           there are none.
+    @return the end of the range of candidates starting at result_begin
+  */
+  template <typename Derived1, typename Derived2, typename Derived3,
+            typename IgnoreFn>
+  static ResultIterator
+  stopper_candidates(PointCloud const& pc,
+                     Eigen::MatrixBase<Derived1> const& location,
+                     Eigen::MatrixBase<Derived2> const& direction,
+                     Eigen::MatrixBase<Derived3> const& point_on_sphere,
+                     const IgnoreFn& ignoreFn,
+                     ResultIterator result_begin) {
+    using number_type = typename Derived1::Scalar;
+    auto const pred = make_ray_predicates(location, direction, point_on_sphere);
+    number_type const v_p = direction.dot(point_on_sphere);
+    number_type const v_p_err = error_factor<number_type>(pc.dim()) *
+        direction.cwiseAbs().dot(point_on_sphere.cwiseAbs());
+    auto result_end = result_begin;
+    pc.halfspace_search(direction, v_p, v_p_err, [&](size_type idx) {
+      if (!ignoreFn(idx)) {
+        auto const& q = pc[idx];
+        if (pred.den_sign(pred.eval(q, location.dot(q), direction.dot(q),
+                                    pc.sq_norm(idx))) < 0)
+          *result_end++ = idx;
+      }
+      return false;
+    });
+    return result_end;
+  }
 
   PointCloud const& _pc;
   ResultIterator    _current;